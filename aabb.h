@@ -0,0 +1,53 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <algorithm>
+#include <cmath>
+
+#include "vec3.h"
+
+// axis aligned bounding box, empty (lo > hi) when default constructed
+class aabb {
+    public:
+        point3 lo;
+        point3 hi;
+
+        aabb() : lo(INFINITY, INFINITY, INFINITY), hi(-INFINITY, -INFINITY, -INFINITY) {}
+        aabb(const point3& a, const point3& b) : lo(a), hi(b) {}
+
+        void grow(const point3& p) {
+            lo = point3(std::min(lo.x(), p.x()), std::min(lo.y(), p.y()), std::min(lo.z(), p.z()));
+            hi = point3(std::max(hi.x(), p.x()), std::max(hi.y(), p.y()), std::max(hi.z(), p.z()));
+        }
+
+        void grow(const aabb& b) {
+            grow(b.lo);
+            grow(b.hi);
+        }
+
+        point3 centroid() const { return 0.5 * (lo + hi); }
+        vec3 extent() const { return hi - lo; }
+
+        real surface_area() const {
+            vec3 e = extent();
+            return 2.0 * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+        }
+
+        // slab test, inv_dir is 1 / ray direction per axis
+        // t_entry receives the distance where the ray enters the box
+        bool hit(const point3& orig, const vec3& inv_dir, real tmin, real tmax, real& t_entry) const {
+            for (int a = 0; a < 3; a++) {
+                real t0 = (lo[a] - orig[a]) * inv_dir[a];
+                real t1 = (hi[a] - orig[a]) * inv_dir[a];
+                if (t0 > t1) std::swap(t0, t1);
+                // written so a NaN (0 * inf) leaves the interval unchanged
+                tmin = t0 > tmin ? t0 : tmin;
+                tmax = t1 < tmax ? t1 : tmax;
+                if (tmax < tmin) return false;
+            }
+            t_entry = tmin;
+            return true;
+        }
+};
+
+#endif
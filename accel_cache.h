@@ -0,0 +1,263 @@
+#ifndef ACCEL_CACHE_H
+#define ACCEL_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ACCEL_CACHE_MMAP 1
+#endif
+
+#include "aabb.h"
+#include "accelerator.h"
+#include "parallel.h"
+#include "primitive.h"
+
+#define ACCEL_CACHE_VERSION 1
+#define ACCEL_CACHE_HASH_CHUNK 65536
+#define ACCEL_CACHE_HEADER_BYTES 128 // keeps the nodes after it 64 byte aligned
+#define ACCEL_CACHE_MAX_DEPTH 64     // levels the fixed traversal stacks are sized for
+
+// Read-only view of a whole file, memory mapped where the platform allows it
+// and read into an aligned heap buffer otherwise.
+class mapped_file {
+public:
+    explicit mapped_file(const std::string& path) {
+#if defined(ACCEL_CACHE_MMAP)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                bytes = static_cast<const unsigned char*>(p);
+                length = size_t(st.st_size);
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) return;
+        length = size_t(in.tellg());
+        buffer.reset(new unsigned char[length + 64]);
+        unsigned char* aligned = buffer.get() + (64 - reinterpret_cast<uintptr_t>(buffer.get()) % 64) % 64;
+        in.seekg(0);
+        if (!in.read(reinterpret_cast<char*>(aligned), std::streamsize(length))) length = 0;
+        bytes = aligned;
+#endif
+    }
+
+    ~mapped_file() {
+#if defined(ACCEL_CACHE_MMAP)
+        if (bytes) ::munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool valid() const { return bytes != nullptr && length > 0; }
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#if !defined(ACCEL_CACHE_MMAP)
+    std::unique_ptr<unsigned char[]> buffer;
+#endif
+};
+
+// fixed size file header, the node array starts right after it
+struct accel_cache_header {
+    char magic[8];            // "HW2ACCEL"
+    uint32_t version;
+    uint32_t byte_order;      // 0x01020304 as written
+    char kind[8];             // accelerator name, e.g. "bvh8"
+    uint32_t node_size;
+    uint32_t reserved;
+    uint64_t scene_hash;
+    uint64_t scene_count;
+    uint64_t node_count;
+    uint64_t prim_count;      // uint32 scene indices of the leaves follow the nodes
+    uint64_t unbounded_count; // then the indices of the unbounded primitives
+};
+static_assert(sizeof(accel_cache_header) <= ACCEL_CACHE_HEADER_BYTES, "cache header must fit before the nodes");
+
+inline uint64_t fnv1a(uint64_t h, const void* data, size_t size) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Content hash of everything an acceleration structure build depends on: the
+// primitive count, which primitives are bounded, and their boxes. Chunks have a
+// fixed size so the hash does not depend on the number of threads.
+inline uint64_t scene_hash(const std::vector<primitive*>& scene) {
+    size_t chunks = (scene.size() + ACCEL_CACHE_HASH_CHUNK - 1) / ACCEL_CACHE_HASH_CHUNK;
+    std::vector<uint64_t> partial(chunks);
+    parallel_for(chunks, [&](size_t c) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        size_t end = std::min(scene.size(), (c + 1) * ACCEL_CACHE_HASH_CHUNK);
+        for (size_t i = c * ACCEL_CACHE_HASH_CHUNK; i < end; i++) {
+            aabb box;
+            unsigned char bounded = scene[i]->bounding_box(box) ? 1 : 0;
+            h = fnv1a(h, &bounded, 1);
+            if (bounded) {
+                h = fnv1a(h, box.lo.e, 3 * sizeof(box.lo.e[0])); // not the w padding
+                h = fnv1a(h, box.hi.e, 3 * sizeof(box.hi.e[0]));
+            }
+        }
+        partial[c] = h;
+    }, 1);
+
+    uint64_t count = scene.size();
+    uint64_t h = fnv1a(0xcbf29ce484222325ull, &count, sizeof(count));
+    return fnv1a(h, partial.data(), partial.size() * sizeof(uint64_t));
+}
+
+// Writes the nodes and primitive order of accel to path. Accel must provide
+// cache_kind(), get_nodes(), get_node_count(), get_prims() and get_unbounded().
+// Written to a temporary file first so a concurrent reader never sees half of it.
+template <typename Accel>
+bool save_accel_cache(const std::string& path, const Accel& accel, const std::vector<primitive*>& scene, uint64_t hash) {
+    using node = typename Accel::node;
+
+    std::unordered_map<const primitive*, uint32_t> index_of;
+    index_of.reserve(scene.size());
+    for (size_t i = 0; i < scene.size(); i++) index_of[scene[i]] = uint32_t(i);
+
+    std::vector<uint32_t> prim_ids, unbounded_ids;
+    for (auto* p : accel.get_prims()) prim_ids.push_back(index_of[p]);
+    for (auto* p : accel.get_unbounded()) unbounded_ids.push_back(index_of[p]);
+
+    unsigned char header_block[ACCEL_CACHE_HEADER_BYTES] = {};
+    accel_cache_header header = {};
+    std::memcpy(header.magic, "HW2ACCEL", 8);
+    header.version = ACCEL_CACHE_VERSION;
+    header.byte_order = 0x01020304u;
+    std::strncpy(header.kind, Accel::cache_kind(), sizeof(header.kind));
+    header.node_size = uint32_t(sizeof(node));
+    header.scene_hash = hash;
+    header.scene_count = scene.size();
+    header.node_count = accel.get_node_count();
+    header.prim_count = prim_ids.size();
+    header.unbounded_count = unbounded_ids.size();
+    std::memcpy(header_block, &header, sizeof(header));
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(header_block), sizeof(header_block));
+        out.write(reinterpret_cast<const char*>(accel.get_nodes()), std::streamsize(header.node_count * sizeof(node)));
+        out.write(reinterpret_cast<const char*>(prim_ids.data()), std::streamsize(prim_ids.size() * sizeof(uint32_t)));
+        out.write(reinterpret_cast<const char*>(unbounded_ids.data()), std::streamsize(unbounded_ids.size() * sizeof(uint32_t)));
+        if (!out) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+// Maps a cache written by save_accel_cache and checks it belongs to this scene
+// and build, returns nullptr if the file is missing, stale or malformed.
+// The nodes are used in place from the mapping.
+template <typename Accel>
+std::unique_ptr<Accel> load_accel_cache(const std::string& path, const std::vector<primitive*>& scene, uint64_t hash) {
+    using node = typename Accel::node;
+
+    auto file = std::make_shared<const mapped_file>(path);
+    if (!file->valid() || file->size() < ACCEL_CACHE_HEADER_BYTES) return nullptr;
+
+    accel_cache_header header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    char kind[sizeof(header.kind)] = {};
+    std::strncpy(kind, Accel::cache_kind(), sizeof(kind));
+    if (std::memcmp(header.magic, "HW2ACCEL", 8) != 0
+        || header.version != ACCEL_CACHE_VERSION
+        || header.byte_order != 0x01020304u
+        || std::memcmp(header.kind, kind, sizeof(kind)) != 0
+        || header.node_size != sizeof(node)
+        || header.scene_hash != hash
+        || header.scene_count != scene.size()
+        || header.prim_count + header.unbounded_count != scene.size())
+        return nullptr;
+
+    if (header.node_count > file->size() / sizeof(node)) return nullptr;
+    uint64_t expected = ACCEL_CACHE_HEADER_BYTES + header.node_count * sizeof(node) + (header.prim_count + header.unbounded_count) * sizeof(uint32_t);
+    if (file->size() != expected) return nullptr;
+
+    const node* nodes = reinterpret_cast<const node*>(file->data() + ACCEL_CACHE_HEADER_BYTES);
+    const unsigned char* ids = file->data() + ACCEL_CACHE_HEADER_BYTES + header.node_count * sizeof(node);
+
+    // the ids are a permutation of the scene, a repeat would leave an object out
+    std::vector<primitive*> prims(header.prim_count), unbounded(header.unbounded_count);
+    std::vector<bool> seen(scene.size(), false);
+    for (size_t i = 0; i < prims.size() + unbounded.size(); i++) {
+        uint32_t id;
+        std::memcpy(&id, ids + i * sizeof(uint32_t), sizeof(id));
+        if (id >= scene.size() || seen[id]) return nullptr;
+        seen[id] = true;
+        if (i < prims.size()) prims[i] = scene[id];
+        else unbounded[i - prims.size()] = scene[id];
+    }
+
+    // every child reference must stay inside the arrays it indexes, and the
+    // nodes must form the depth-first tree the builders write: an inner child
+    // comes after its parent and has no other parent, so traversal cannot
+    // loop, and the tree is no deeper than the traversal stacks allow
+    constexpr uint32_t max_children = sizeof(node::child) / sizeof(node::child[0]);
+    std::vector<uint8_t> depth(header.node_count, 0); // 0: not reached from the root
+    if (header.node_count > 0) depth[0] = 1;
+    for (uint64_t i = 0; i < header.node_count; i++) {
+        const node& n = nodes[i];
+        if (depth[i] == 0 || n.count == 0 || n.count > max_children) return nullptr;
+        for (uint32_t c = 0; c < n.count; c++) {
+            uint32_t ref = n.child[c];
+            if (ref & Accel::LEAF_BIT) {
+                if ((ref & ~Accel::LEAF_BIT) >= header.prim_count) return nullptr;
+                continue;
+            }
+            if (ref <= i || ref >= header.node_count || depth[ref] != 0 || depth[i] >= ACCEL_CACHE_MAX_DEPTH)
+                return nullptr;
+            depth[ref] = uint8_t(depth[i] + 1);
+        }
+    }
+
+    return std::make_unique<Accel>(file, nodes, size_t(header.node_count), std::move(prims), std::move(unbounded));
+}
+
+// Loads the structure for scene from path when a valid cache exists there,
+// otherwise builds it and writes the cache for the next run. Whether it was
+// loaded, or could not be saved, is reported to log when given.
+template <typename Accel>
+std::unique_ptr<accelerator> cached_accelerator(const std::string& path, const std::vector<primitive*>& scene,
+                                                const std::function<void(const std::string&)>& log = nullptr) {
+    uint64_t hash = scene_hash(scene);
+    if (auto loaded = load_accel_cache<Accel>(path, scene, hash)) {
+        if (log) log("Loaded acceleration structure from " + path);
+        return loaded;
+    }
+    auto built = std::make_unique<Accel>(scene);
+    if (!save_accel_cache(path, *built, scene, hash) && log)
+        log("Could not write acceleration structure cache " + path);
+    return built;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#include "accel_factory.h"
+
+#include "accel_cache.h"
+#include "bvh.h"
+#include "bvh_compressed.h"
+#include "bvh_wide.h"
+#include "grid.h"
+
+#include <stdexcept>
+
+std::string resolve_accelerator(const std::string& name, const std::vector<primitive*>& scene) {
+    if (name == "auto") return grid_suits_scene(scene) ? "grid" : "bvh8";
+    return name;
+}
+
+std::unique_ptr<accelerator> make_accelerator(const std::string& name, const std::vector<primitive*>& scene) {
+    std::string kind = resolve_accelerator(name, scene);
+    if (kind == "bvh2") return std::make_unique<bvh>(scene);
+    if (kind == "bvh4") return std::make_unique<bvh4>(scene);
+    if (kind == "bvh8") return std::make_unique<bvh8>(scene);
+    if (kind == "bvh4c") return std::make_unique<compressed_bvh>(scene);
+    if (kind == "grid") return std::make_unique<uniform_grid>(scene);
+    throw std::runtime_error("Unknown acceleration structure: " + name);
+}
+
+std::unique_ptr<accelerator> make_cached_accelerator(const std::string& name, const std::vector<primitive*>& scene,
+                                                     const std::string& cache_path,
+                                                     const std::function<void(const std::string&)>& log) {
+    std::string kind = resolve_accelerator(name, scene);
+    if (kind == "bvh4") return cached_accelerator<bvh4>(cache_path, scene, log);
+    if (kind == "bvh8") return cached_accelerator<bvh8>(cache_path, scene, log);
+    if (kind == "bvh4c") return cached_accelerator<compressed_bvh>(cache_path, scene, log);
+    return make_accelerator(kind, scene);
+}
@@ -0,0 +1,31 @@
+#ifndef ACCEL_FACTORY_H
+#define ACCEL_FACTORY_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "accelerator.h"
+#include "primitive.h"
+
+// The acceleration structures by name, defined in accel_factory.cpp so hw2,
+// the renderer library and the benchmarks all build them the same way.
+
+/// the structure name stands for over scene: auto picks a grid for dense,
+/// even scenes of similar primitives and bvh8 otherwise, other names are kept
+std::string resolve_accelerator(const std::string& name, const std::vector<primitive*>& scene);
+
+/// builds auto, bvh2, bvh4, bvh8, bvh4c or grid over scene
+/// @throws std::runtime_error for any other name
+std::unique_ptr<accelerator> make_accelerator(const std::string& name, const std::vector<primitive*>& scene);
+
+/// same as make_accelerator, but reuses the structure saved at cache_path when it
+/// was built for identical primitives and saves it there otherwise; the binary
+/// bvh and the grid are never cached
+/// @param log  told when the cache was loaded or could not be written
+std::unique_ptr<accelerator> make_cached_accelerator(const std::string& name, const std::vector<primitive*>& scene,
+                                                     const std::string& cache_path,
+                                                     const std::function<void(const std::string&)>& log = nullptr);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ray.h"
+#include "primitive.h"
+
+#ifdef HW2_TRAVERSAL_STATS
+// nodes (grid cells for the grid) visited by the traversals of the calling thread
+inline thread_local uint64_t traversal_node_visits = 0;
+#define COUNT_NODE_VISIT() (traversal_node_visits++)
+#else
+#define COUNT_NODE_VISIT() ((void)0)
+#endif
+
+// spatial index over the scene, answers every ray query the camera makes
+class accelerator {
+public:
+    virtual ~accelerator() = default;
+    /// @return true if something is hit in [tmin, tmax], hit_out then holds the nearest hit with prim set
+    virtual bool closest_hit(const ray& r, real tmin, real tmax, hit_struct& hit_out) const = 0;
+    /// @return true if anything is hit in [tmin, tmax], stops at the first hit found
+    virtual bool occluded(const ray& r, real tmin, real tmax) const = 0;
+    /// closest_hit for a batch of rays, hit[i] tells whether hits_out[i] was set;
+    /// traced one by one here, the wide BVHs trace packets of rays together
+    virtual void closest_hit_stream(const ray* rays, size_t count, real tmin, const real* tmax,
+                                    hit_struct* hits_out, unsigned char* hit) const {
+        for (size_t i = 0; i < count; i++) hit[i] = closest_hit(rays[i], tmin, tmax[i], hits_out[i]);
+    }
+    /// occluded for a batch of rays, blocked[i] is its result
+    virtual void occluded_stream(const ray* rays, size_t count, real tmin, const real* tmax,
+                                 unsigned char* blocked) const {
+        for (size_t i = 0; i < count; i++) blocked[i] = occluded(rays[i], tmin, tmax[i]);
+    }
+    /// @return bytes held by the structure itself (nodes and primitive references)
+    virtual size_t memory_bytes() const = 0;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define ARENA_BLOCK_BYTES (1 << 20)
+#define ARENA_ALIGN 64 // block alignment, enough for any vec3 and a cache line
+
+// Bump allocator that places objects one after another in large blocks.
+// Objects are never freed one by one: the arena runs their destructors, in
+// reverse order of creation, and releases its few blocks when it is destroyed.
+class arena {
+public:
+    explicit arena(size_t block_bytes = ARENA_BLOCK_BYTES) : block_bytes(block_bytes) {}
+
+    ~arena() {
+        for (auto it = destructors.rbegin(); it != destructors.rend(); ++it) it->destroy(it->object);
+        for (void* b : blocks) ::operator delete(b, std::align_val_t(ARENA_ALIGN));
+    }
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    /// constructs a T in the arena, it lives as long as the arena
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        static_assert(alignof(T) <= ARENA_ALIGN, "type is over-aligned for the arena");
+        void* p = allocate(sizeof(T), alignof(T));
+        if (std::is_trivially_destructible<T>::value) return new (p) T(std::forward<Args>(args)...);
+
+        // reserve the destructor slot first so a failed push cannot leak a live object
+        destructors.push_back({p, [](void* obj) { static_cast<T*>(obj)->~T(); }});
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            destructors.pop_back();
+            throw;
+        }
+    }
+
+    /// raw storage that lives as long as the arena
+    void* allocate(size_t size, size_t align) {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (blocks.empty() || offset + size > current_bytes) {
+            current_bytes = std::max(block_bytes, size);
+            blocks.reserve(blocks.size() + 1);
+            total_bytes += current_bytes;
+            blocks.push_back(::operator new(current_bytes, std::align_val_t(ARENA_ALIGN)));
+            offset = 0;
+        }
+        used = offset + size;
+        return static_cast<unsigned char*>(blocks.back()) + offset;
+    }
+
+    /// @return bytes of all blocks allocated so far
+    size_t bytes_reserved() const { return total_bytes; }
+
+private:
+    struct destructor {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    size_t block_bytes;
+    std::vector<void*> blocks;
+    size_t current_bytes = 0; // size of blocks.back()
+    size_t used = 0;          // bytes handed out from blocks.back()
+    size_t total_bytes = 0;
+    std::vector<destructor> destructors;
+};
+
+#endif
@@ -0,0 +1,294 @@
+// Micro-benchmarks of the hot kernels: primitive tests, closest hit over
+// growing scenes for every acceleration structure, shading with many lights,
+// scene parsing and PNG encoding. Every benchmark runs BENCH_REPEATS times
+// after a warm-up and reports the median with the fastest and slowest run.
+//
+// Usage: hw2_bench [name filter]
+
+#include "camera.h"
+#include "parser.h"
+#include "scene_data.h"
+#include "sphere.h"
+#include "plane.h"
+#include "accel_factory.h"
+#include "bvh_wide.h"
+#include "light_table.h"
+#include "directional_light.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_REPEATS 7
+#define BENCH_SEED 12345
+#define BENCH_RAYS (1 << 16)
+
+// Last level cache misses of the calling thread from perf_event_open, the
+// portable stand-in for L2 misses. Unavailable (valid() false) off Linux or
+// when the kernel refuses, e.g. a high perf_event_paranoid or a container.
+class cache_miss_counter {
+public:
+    cache_miss_counter() {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~cache_miss_counter() {
+#ifdef __linux__
+        if (fd >= 0) close(fd);
+#endif
+    }
+    cache_miss_counter(const cache_miss_counter&) = delete;
+    cache_miss_counter& operator=(const cache_miss_counter&) = delete;
+
+    bool valid() const { return fd >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    uint64_t stop() {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (fd < 0) return 0;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+        return count;
+    }
+
+private:
+    int fd = -1;
+};
+
+struct bench_result {
+    double median_ns; // per operation
+    double min_ns;
+    double max_ns;
+    double misses;    // cache misses per operation in the median run, < 0 if unavailable
+};
+
+// runs fn (which performs ops operations) once to warm up, then BENCH_REPEATS times
+template <typename F>
+bench_result measure(size_t ops, F&& fn) {
+    static cache_miss_counter counter;
+    fn();
+    std::vector<std::pair<double, uint64_t>> runs;
+    for (int k = 0; k < BENCH_REPEATS; k++) {
+        counter.start();
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        auto t1 = std::chrono::steady_clock::now();
+        uint64_t misses = counter.stop();
+        runs.emplace_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / double(ops), misses);
+    }
+    std::sort(runs.begin(), runs.end());
+    const auto& median = runs[runs.size() / 2];
+    return {median.first, runs.front().first, runs.back().first,
+            counter.valid() ? double(median.second) / double(ops) : -1.0};
+}
+
+// keeps results alive so the compiler cannot drop the benchmarked work
+static volatile uint64_t sink;
+
+static std::string filter;
+
+static void report(const std::string& name, const bench_result& r, const std::string& extra = "") {
+    char line[256];
+    char misses[32] = "n/a";
+    if (r.misses >= 0) std::snprintf(misses, sizeof(misses), "%.3f", r.misses);
+    std::snprintf(line, sizeof(line), "%-34s %10.2f  (%8.2f .. %8.2f) %10.3f  %9s",
+                  name.c_str(), r.median_ns, r.min_ns, r.max_ns, 1e3 / r.median_ns, misses);
+    std::cout << line << (extra.empty() ? "" : "  " + extra) << "\n";
+}
+
+static bool selected(const std::string& name) {
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+// spheres of radius about 0.02 spread uniformly over the box the camera looks at
+static void add_random_spheres(scene_data& scene, size_t n, std::mt19937& gen) {
+    std::uniform_real_distribution<double> xy(-2.0, 2.0), z(-6.0, -1.0), rad(0.01, 0.03), c(0.0, 1.0);
+    for (size_t k = 0; k < n; k++) {
+        primitive* obj = scene.create<sphere>(point3(xy(gen), xy(gen), z(gen)), rad(gen));
+        material_t m;
+        m.ambient = m.diffuse = color(c(gen), c(gen), c(gen));
+        m.shininess = 32.0f;
+        obj->set_material(m);
+        scene.add_object(obj);
+    }
+}
+
+// rays from the default eye position through random points of the screen
+static std::vector<ray> camera_rays(size_t n, std::mt19937& gen) {
+    std::uniform_real_distribution<double> screen(-1.0, 1.0);
+    std::vector<ray> rays;
+    point3 eye(0, 0, 4);
+    for (size_t k = 0; k < n; k++) rays.push_back(ray(eye, point3(screen(gen), screen(gen), 0) - eye));
+    return rays;
+}
+
+static void bench_primitives(std::mt19937& gen) {
+    std::vector<ray> rays = camera_rays(BENCH_RAYS, gen);
+    sphere s(point3(0, 0, -2), 1.0);
+    plane p(0, 1, 0, 1);
+    const primitive* prims[2] = {&s, &p};
+    const char* names[2] = {"sphere::hit", "plane::hit"};
+    for (int k = 0; k < 2; k++) {
+        if (!selected(names[k])) continue;
+        const primitive& obj = *prims[k];
+        bench_result r = measure(rays.size(), [&] {
+            uint64_t hits = 0;
+            hit_struct h;
+            for (const ray& ray_k : rays) hits += obj.hit(ray_k, 0.001, INFINITY, h);
+            sink = hits;
+        });
+        report(names[k], r);
+    }
+}
+
+// closest hit of camera rays, the work of get_min_intersection, over n spheres
+static void bench_closest_hit(std::mt19937& gen) {
+    const char* accels[] = {"bvh2", "bvh4", "bvh8", "bvh4c", "grid"};
+    std::vector<ray> rays = camera_rays(BENCH_RAYS, gen);
+    for (size_t n : {size_t(16), size_t(4096), size_t(262144)}) {
+        scene_data scene;
+        add_random_spheres(scene, n, gen);
+        for (const char* accel_name : accels) {
+            std::string name = std::string("closest_hit/") + accel_name + "/" + std::to_string(n);
+            if (!selected(name)) continue;
+            auto accel = make_accelerator(accel_name, scene.get_objects());
+            bench_result r = measure(rays.size(), [&] {
+                uint64_t hits = 0;
+                hit_struct h;
+                for (const ray& ray_k : rays) hits += accel->closest_hit(ray_k, 0.001, INFINITY, h);
+                sink = hits;
+            });
+            char extra[64];
+            std::snprintf(extra, sizeof(extra), "%.1f B/prim", double(accel->memory_bytes()) / double(n));
+            report(name, r, extra);
+        }
+    }
+}
+
+// closest hit and shading of camera rays over a floor and 4096 spheres, n directional lights
+static void bench_shade(std::mt19937& gen) {
+    scene_data scene;
+    add_random_spheres(scene, 4096, gen);
+    primitive* floor = scene.create<plane>(0, 1, 0, 2);
+    material_t m;
+    m.ambient = m.diffuse = color(0.8, 0.8, 0.8);
+    m.shininess = 10.0f;
+    floor->set_material(m);
+    scene.add_object(floor);
+    bvh8 accel(scene.get_objects());
+    camera cam(point3(0, 0, 4), 64, 64, color(0, 0, 0));
+    std::vector<ray> rays = camera_rays(BENCH_RAYS / 4, gen);
+
+    std::uniform_real_distribution<double> dir(-1.0, 1.0);
+    for (size_t n : {size_t(1), size_t(8), size_t(64)}) {
+        std::string name = "shade/lights/" + std::to_string(n);
+        if (!selected(name)) continue;
+        std::vector<light_source*> lights;
+        for (size_t k = 0; k < n; k++)
+            lights.push_back(scene.create<directional_light>(vec3(dir(gen), -1.0, dir(gen)), color(0.5, 0.5, 0.5)));
+        light_table table(lights);
+        bench_result r = measure(rays.size(), [&] {
+            color sum(0, 0, 0);
+            for (const ray& ray_k : rays) sum += cam.trace(ray_k, accel, table, color(0.1, 0.1, 0.1));
+            sink = uint64_t(sum.x());
+        });
+        report(name, r);
+    }
+}
+
+// load and object creation of a scene file of n spheres, per line
+static void bench_parser(std::mt19937& gen) {
+    const size_t n = 100000;
+    if (!selected("parser")) return;
+    std::string path = (std::filesystem::temp_directory_path() / "hw2_bench_scene.txt").string();
+    {
+        std::ofstream out(path);
+        std::uniform_real_distribution<double> xy(-2.0, 2.0), z(-6.0, -1.0), c(0.0, 1.0);
+        out << "e 0.0 0.0 4.0 1.0\na 0.1 0.1 0.1 1.0\n";
+        for (size_t k = 0; k < n; k++) out << "o " << xy(gen) << " " << xy(gen) << " " << z(gen) << " 0.02\n";
+        for (size_t k = 0; k < n; k++) out << "c " << c(gen) << " " << c(gen) << " " << c(gen) << " 32\n";
+        out << "d 0.0 -1.0 -1.0 0.0\ni 1.0 1.0 1.0 1.0\n";
+    }
+    size_t lines = 2 * n + 4;
+    double bytes = double(std::filesystem::file_size(path));
+    bench_result r = measure(lines, [&] {
+        parser p;
+        p.load(path);
+        scene_data scene;
+        p.get_scene_objects(scene);
+        p.get_lights(scene);
+        sink = scene.get_objects().size();
+    });
+    char extra[64];
+    std::snprintf(extra, sizeof(extra), "%.1f MB/s", bytes / (r.median_ns * double(lines)) * 1e3);
+    report("parser/line", r, extra);
+    std::filesystem::remove(path);
+}
+
+// PNG encoding of a 512x512 render-like image, per pixel
+static void bench_png() {
+    if (!selected("png")) return;
+    const int w = 512, h = 512;
+    std::vector<unsigned char> pixels(size_t(w) * h * 3);
+    for (int j = 0; j < h; j++)
+        for (int i = 0; i < w; i++)
+            for (int c = 0; c < 3; c++)
+                pixels[(size_t(j) * w + i) * 3 + c] = (unsigned char)((i * (c + 1) + j * (3 - c)) / 4 + ((i ^ j) & 7));
+    // encoded in memory, the callback only sees the finished PNG
+    bench_result r = measure(size_t(w) * h, [&] {
+        stbi_write_png_to_func([](void*, void*, int size) { sink = uint64_t(size); }, nullptr,
+                               w, h, 3, pixels.data(), w * 3);
+    });
+    report("png_write/pixel", r);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2) filter = argv[1];
+    std::mt19937 gen(BENCH_SEED);
+
+    char header[256];
+    std::snprintf(header, sizeof(header), "%-34s %10s  (%8s .. %8s) %10s  %9s", "benchmark", "ns/op", "min", "max", "Mop/s", "miss/op");
+    std::cout << header << "\n";
+    bench_primitives(gen);
+    bench_closest_hit(gen);
+    bench_shade(gen);
+    bench_parser(gen);
+    bench_png();
+    std::cout << "Mop/s is million rays per second for ray kernels, miss/op is last level cache misses\n";
+    return 0;
+}
@@ -0,0 +1,279 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "aabb.h"
+#include "accelerator.h"
+#include "morton.h"
+#include "parallel.h"
+#include "primitive.h"
+#include "radix_sort.h"
+
+#define BVH_STACK_SIZE 128
+
+// Linear BVH (Karras 2012, "Maximizing Parallelism in the Construction of BVHs").
+// Bounded primitives are sorted by the Morton code of their box centroid and the
+// binary radix tree over the sorted codes is emitted with every internal node
+// computed independently, so the sort, the hierarchy and the bounds all build in
+// parallel. Unbounded primitives (planes) are kept aside and tested linearly.
+class bvh : public accelerator {
+public:
+    // high bit of a child reference marks a leaf, the rest indexes prims
+    static constexpr uint32_t LEAF_BIT = 0x80000000u;
+
+    // internal node, stores the boxes of both children so they can be ordered
+    struct node {
+        aabb child_box[2];
+        uint32_t child[2];
+    };
+
+    explicit bvh(const std::vector<primitive*>& scene) { build(scene); }
+
+    bool closest_hit(const ray& r, real tmin, real tmax, hit_struct& hit_out) const override {
+        bool hit_any = false;
+        hit_struct tmp;
+        for (auto* obj : unbounded) {
+            if (obj->hit(r, tmin, tmax, tmp)) {
+                hit_out = tmp;
+                tmax = tmp.t;
+                hit_any = true;
+            }
+        }
+        if (prims.empty()) return hit_any;
+
+        if (root & LEAF_BIT) {
+            primitive* obj = prims[root & ~LEAF_BIT];
+            if (obj->hit(r, tmin, tmax, tmp)) {
+                hit_out = tmp;
+                hit_any = true;
+            }
+            return hit_any;
+        }
+
+        vec3 inv_dir = inverse(r.direction());
+        uint32_t stack[BVH_STACK_SIZE];
+        int top = 0;
+        stack[top++] = root;
+
+        while (top > 0) {
+            uint32_t ref = stack[--top];
+            if (ref & LEAF_BIT) {
+                primitive* obj = prims[ref & ~LEAF_BIT];
+                if (obj->hit(r, tmin, tmax, tmp)) {
+                    hit_out = tmp;
+                    tmax = tmp.t;
+                    hit_any = true;
+                }
+                continue;
+            }
+
+            const node& n = nodes[ref];
+            COUNT_NODE_VISIT();
+
+            real t0, t1;
+            bool hit0 = n.child_box[0].hit(r.origin(), inv_dir, tmin, tmax, t0);
+            bool hit1 = n.child_box[1].hit(r.origin(), inv_dir, tmin, tmax, t1);
+            if (hit0 && hit1) {
+                // push the far child first so the near one is visited next
+                bool near_first = t0 <= t1;
+                stack[top++] = n.child[near_first ? 1 : 0];
+                stack[top++] = n.child[near_first ? 0 : 1];
+            } else if (hit0) {
+                stack[top++] = n.child[0];
+            } else if (hit1) {
+                stack[top++] = n.child[1];
+            }
+        }
+        return hit_any;
+    }
+
+    bool occluded(const ray& r, real tmin, real tmax) const override {
+        for (auto* obj : unbounded)
+            if (obj->any_hit(r, tmin, tmax)) return true;
+        if (prims.empty()) return false;
+
+        vec3 inv_dir = inverse(r.direction());
+        uint32_t stack[BVH_STACK_SIZE];
+        int top = 0;
+        stack[top++] = root;
+
+        while (top > 0) {
+            uint32_t ref = stack[--top];
+            if (ref & LEAF_BIT) {
+                if (prims[ref & ~LEAF_BIT]->any_hit(r, tmin, tmax)) return true;
+                continue;
+            }
+            const node& n = nodes[ref];
+            COUNT_NODE_VISIT();
+            real t_entry;
+            if (n.child_box[0].hit(r.origin(), inv_dir, tmin, tmax, t_entry)) stack[top++] = n.child[0];
+            if (n.child_box[1].hit(r.origin(), inv_dir, tmin, tmax, t_entry)) stack[top++] = n.child[1];
+        }
+        return false;
+    }
+
+    size_t memory_bytes() const override {
+        return nodes.size() * sizeof(node) + (prims.size() + unbounded.size()) * sizeof(primitive*);
+    }
+
+    const std::vector<node>& get_nodes() const { return nodes; }
+    const std::vector<primitive*>& get_prims() const { return prims; }
+    const std::vector<primitive*>& get_unbounded() const { return unbounded; }
+    uint32_t get_root() const { return root; }
+
+private:
+    std::vector<node> nodes;           // internal nodes, nodes[0] is the root when there are >= 2 prims
+    std::vector<primitive*> prims;     // bounded primitives in Morton order, leaves index into this
+    std::vector<primitive*> unbounded;
+    uint32_t root = 0;
+
+    static vec3 inverse(const vec3& d) {
+        return vec3(1 / d.x(), 1 / d.y(), 1 / d.z());
+    }
+
+    void build(const std::vector<primitive*>& scene) {
+        // query boxes in parallel, then compact the bounded primitives
+        std::vector<aabb> all_boxes(scene.size());
+        std::vector<char> has_box(scene.size());
+        parallel_for(scene.size(), [&](size_t i) {
+            has_box[i] = scene[i]->bounding_box(all_boxes[i]);
+        });
+
+        std::vector<primitive*> bounded;
+        std::vector<aabb> boxes;
+        bounded.reserve(scene.size());
+        boxes.reserve(scene.size());
+        for (size_t i = 0; i < scene.size(); i++) {
+            if (has_box[i]) {
+                bounded.push_back(scene[i]);
+                boxes.push_back(all_boxes[i]);
+            } else {
+                unbounded.push_back(scene[i]);
+            }
+        }
+
+        size_t n = bounded.size();
+        if (n == 0) return;
+
+        // centroid bounds, one partial box per chunk
+        unsigned chunks = chunk_count(n);
+        std::vector<aabb> partial(chunks);
+        parallel_chunks(n, chunks, [&](unsigned c, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) partial[c].grow(boxes[i].centroid());
+        });
+        aabb centroids;
+        for (const auto& b : partial) centroids.grow(b);
+
+        // Morton codes relative to the centroid bounds, flat axes map to 0
+        std::vector<uint32_t> codes(n), order(n);
+        vec3 ext = centroids.extent();
+        vec3 scale(ext.x() > 0 ? 1.0 / ext.x() : 0.0,
+                   ext.y() > 0 ? 1.0 / ext.y() : 0.0,
+                   ext.z() > 0 ? 1.0 / ext.z() : 0.0);
+        parallel_for(n, [&](size_t i) {
+            vec3 rel = (boxes[i].centroid() - centroids.lo) * scale;
+            codes[i] = morton3d(rel.x(), rel.y(), rel.z());
+            order[i] = uint32_t(i);
+        });
+
+        radix_sort_pairs(codes, order, 30);
+
+        prims.resize(n);
+        std::vector<aabb> leaf_boxes(n);
+        parallel_for(n, [&](size_t i) {
+            prims[i] = bounded[order[i]];
+            leaf_boxes[i] = boxes[order[i]];
+        });
+
+        if (n == 1) {
+            root = LEAF_BIT;
+            return;
+        }
+
+        // emit the radix tree, internal node i only depends on the sorted codes
+        nodes.resize(n - 1);
+        std::vector<uint32_t> parent(2 * n - 1); // internal nodes first, then leaves at n - 1 + i
+        parallel_for(n - 1, [&](size_t i) {
+            emit_node(codes, int64_t(i), parent);
+        });
+        root = 0;
+
+        // bottom-up bounds: the second thread to reach a node has both children ready
+        std::vector<aabb> node_boxes(n - 1);
+        std::unique_ptr<std::atomic<uint32_t>[]> visits(new std::atomic<uint32_t>[n - 1]);
+        for (size_t i = 0; i + 1 < n; i++) visits[i].store(0, std::memory_order_relaxed);
+
+        parallel_for(n, [&](size_t leaf) {
+            uint32_t current = parent[n - 1 + leaf];
+            while (true) {
+                if (visits[current].fetch_add(1, std::memory_order_acq_rel) == 0) return;
+                node& nd = nodes[current];
+                for (int c = 0; c < 2; c++) {
+                    uint32_t ref = nd.child[c];
+                    nd.child_box[c] = (ref & LEAF_BIT) ? leaf_boxes[ref & ~LEAF_BIT] : node_boxes[ref];
+                }
+                aabb box = nd.child_box[0];
+                box.grow(nd.child_box[1]);
+                node_boxes[current] = box;
+                if (current == root) return;
+                current = parent[current];
+            }
+        }, 1024);
+    }
+
+    // length of the common prefix of the keys at i and j, ties on the code
+    // are broken by the index so every key is unique; -1 when j is out of range
+    static int delta(const std::vector<uint32_t>& codes, int64_t i, int64_t j) {
+        if (j < 0 || j >= int64_t(codes.size())) return -1;
+        if (codes[i] == codes[j]) return 32 + clz32(uint32_t(i ^ j));
+        return clz32(codes[i] ^ codes[j]);
+    }
+
+    void emit_node(const std::vector<uint32_t>& codes, int64_t i, std::vector<uint32_t>& parent) {
+        int64_t n = int64_t(codes.size());
+
+        // direction of the range covered by node i
+        int d = delta(codes, i, i + 1) - delta(codes, i, i - 1) > 0 ? 1 : -1;
+        int delta_min = delta(codes, i, i - d);
+
+        // upper bound for the range length, then binary search the other end
+        int64_t l_max = 2;
+        while (delta(codes, i, i + l_max * d) > delta_min) l_max *= 2;
+        int64_t l = 0;
+        for (int64_t t = l_max / 2; t >= 1; t /= 2)
+            if (delta(codes, i, i + (l + t) * d) > delta_min) l += t;
+        int64_t j = i + l * d;
+
+        // binary search the split position inside [i, j]
+        int delta_node = delta(codes, i, j);
+        int64_t s = 0;
+        for (int64_t div = 2;; div *= 2) {
+            int64_t t = (l + div - 1) / div;
+            if (delta(codes, i, i + (s + t) * d) > delta_node) s += t;
+            if (t <= 1) break;
+        }
+        int64_t split = i + s * d + std::min(d, 0);
+
+        node& nd = nodes[i];
+        if (std::min(i, j) == split) {
+            nd.child[0] = LEAF_BIT | uint32_t(split);
+            parent[n - 1 + split] = uint32_t(i);
+        } else {
+            nd.child[0] = uint32_t(split);
+            parent[split] = uint32_t(i);
+        }
+        if (std::max(i, j) == split + 1) {
+            nd.child[1] = LEAF_BIT | uint32_t(split + 1);
+            parent[n - 1 + split + 1] = uint32_t(i);
+        } else {
+            nd.child[1] = uint32_t(split + 1);
+            parent[split + 1] = uint32_t(i);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef BVH_COMPRESSED_H
+#define BVH_COMPRESSED_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "accelerator.h"
+#include "bvh_wide.h"
+#include "primitive.h"
+
+class mapped_file;
+
+// 4-wide BVH whose nodes each fit in one 64 byte cache line. A node stores its
+// own box as a float origin plus a power of two scale per axis, and the boxes of
+// its children as 8-bit offsets in that frame, rounded outward. Nodes are kept
+// in one depth-first array (the layout of the bvh4 it is compressed from) and
+// reference children and primitives with 32-bit indices.
+class compressed_bvh : public accelerator {
+public:
+    static constexpr uint32_t LEAF_BIT = bvh::LEAF_BIT;
+
+    struct alignas(64) node {
+        float origin[3];    // lower corner of this node's box
+        int8_t exponent[3]; // child offsets are scaled by 2^exponent per axis
+        uint8_t count;      // used child slots, packed at the front
+        uint8_t q[6][4];    // child lo x/y/z then hi x/y/z, one byte per child
+        uint32_t child[4];  // LEAF_BIT set: index into prims, otherwise into nodes
+    };
+    static_assert(sizeof(node) == 64, "compressed node should fill exactly one cache line");
+
+    explicit compressed_bvh(const std::vector<primitive*>& scene) : compressed_bvh(bvh4(scene)) {}
+
+    explicit compressed_bvh(const bvh4& wide)
+        : prims(wide.get_prims()), unbounded(wide.get_unbounded())
+    {
+        nodes.resize(wide.get_node_count());
+        for (size_t i = 0; i < nodes.size(); i++) compress(wide.get_nodes()[i], nodes[i]);
+        node_data = nodes.data();
+        node_count = nodes.size();
+    }
+
+    // uses nodes that live in a mapped acceleration structure cache
+    compressed_bvh(std::shared_ptr<const mapped_file> mapping, const node* data, size_t count,
+                   std::vector<primitive*> prims, std::vector<primitive*> unbounded)
+        : prims(std::move(prims)), unbounded(std::move(unbounded)),
+          node_data(data), node_count(count), mapping(std::move(mapping)) {}
+
+    compressed_bvh(const compressed_bvh&) = delete;
+    compressed_bvh& operator=(const compressed_bvh&) = delete;
+
+    static const char* cache_kind() { return "bvh4c"; }
+
+    bool closest_hit(const ray& r, real tmin, real tmax, hit_struct& hit_out) const override {
+        bool hit_any = false;
+        hit_struct tmp;
+        for (auto* obj : unbounded) {
+            if (obj->hit(r, tmin, tmax, tmp)) {
+                hit_out = tmp;
+                tmax = tmp.t;
+                hit_any = true;
+            }
+        }
+        if (node_count == 0) return hit_any;
+
+        float_ray fr(r);
+        struct entry { uint32_t ref; float t; };
+        entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = {0, -INFINITY};
+
+        while (top > 0) {
+            entry e = stack[--top];
+            if (e.t > round_up(tmax)) continue;
+
+            if (e.ref & LEAF_BIT) {
+                primitive* obj = prims[e.ref & ~LEAF_BIT];
+                if (obj->hit(r, tmin, tmax, tmp)) {
+                    hit_out = tmp;
+                    tmax = tmp.t;
+                    hit_any = true;
+                }
+                continue;
+            }
+
+            const node& n = node_data[e.ref];
+            COUNT_NODE_VISIT();
+
+            alignas(16) float tnear[4];
+            unsigned mask = intersect(n, fr, round_down(tmin), round_up(tmax), tnear);
+
+            entry hits[4];
+            int count = 0;
+            for (int lane = 0; lane < 4; lane++) {
+                if (!(mask & (1u << lane))) continue;
+                entry h = {n.child[lane], tnear[lane]};
+                int k = count++;
+                while (k > 0 && hits[k - 1].t < h.t) {
+                    hits[k] = hits[k - 1];
+                    k--;
+                }
+                hits[k] = h;
+            }
+            for (int k = 0; k < count; k++) stack[top++] = hits[k];
+        }
+        return hit_any;
+    }
+
+    bool occluded(const ray& r, real tmin, real tmax) const override {
+        for (auto* obj : unbounded)
+            if (obj->any_hit(r, tmin, tmax)) return true;
+        if (node_count == 0) return false;
+
+        float_ray fr(r);
+        float ftmin = round_down(tmin), ftmax = round_up(tmax);
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            uint32_t ref = stack[--top];
+            if (ref & LEAF_BIT) {
+                if (prims[ref & ~LEAF_BIT]->any_hit(r, tmin, tmax)) return true;
+                continue;
+            }
+            const node& n = node_data[ref];
+            COUNT_NODE_VISIT();
+            alignas(16) float tnear[4];
+            unsigned mask = intersect(n, fr, ftmin, ftmax, tnear);
+            for (int lane = 0; lane < 4; lane++)
+                if (mask & (1u << lane)) stack[top++] = n.child[lane];
+        }
+        return false;
+    }
+
+    size_t memory_bytes() const override {
+        return node_count * sizeof(node) + (prims.size() + unbounded.size()) * sizeof(primitive*);
+    }
+
+    const node* get_nodes() const { return node_data; }
+    size_t get_node_count() const { return node_count; }
+    const std::vector<primitive*>& get_prims() const { return prims; }
+    const std::vector<primitive*>& get_unbounded() const { return unbounded; }
+
+private:
+    static constexpr int STACK_SIZE = 64 * 4;
+
+    std::vector<node> nodes; // depth-first order, nodes[0] is the root, empty when mapped
+    std::vector<primitive*> prims;
+    std::vector<primitive*> unbounded;
+    const node* node_data = nullptr;
+    size_t node_count = 0;
+    std::shared_ptr<const mapped_file> mapping; // keeps mapped nodes alive
+
+    struct float_ray {
+        float o[3];
+        float inv[3];
+        explicit float_ray(const ray& r) {
+            for (int a = 0; a < 3; a++) {
+                o[a] = float(r.origin()[a]);
+                inv[a] = float(1.0 / r.direction()[a]);
+            }
+        }
+    };
+
+    static float round_down(double v) {
+        float f = float(v);
+        return double(f) > v ? std::nextafter(f, -INFINITY) : f;
+    }
+
+    static float round_up(double v) {
+        float f = float(v);
+        return double(f) < v ? std::nextafter(f, INFINITY) : f;
+    }
+
+    // 2^e for a normal float exponent, built from the bits
+    static float exp2i(int e) {
+        uint32_t bits = uint32_t(e + 127) << 23;
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // quantizes the float child boxes of a bvh4 node into the node's own frame
+    static void compress(const bvh4::node& src, node& dst) {
+        const float* lo[3] = {src.lo_x, src.lo_y, src.lo_z};
+        const float* hi[3] = {src.hi_x, src.hi_y, src.hi_z};
+        std::memset(&dst, 0, sizeof(node));
+        dst.count = uint8_t(src.count);
+
+        for (int a = 0; a < 3; a++) {
+            float box_lo = INFINITY, box_hi = -INFINITY;
+            for (uint32_t i = 0; i < src.count; i++) {
+                box_lo = std::min(box_lo, lo[a][i]);
+                box_hi = std::max(box_hi, hi[a][i]);
+            }
+
+            // smallest power of two that spans the box in 255 steps
+            int e = -100;
+            double extent = double(box_hi) - double(box_lo);
+            if (extent > 0) e = std::max(e, int(std::ceil(std::log2(extent / 255.0))));
+            while (double(box_lo) + 255.0 * std::ldexp(1.0, e) < double(box_hi)) e++;
+
+            dst.origin[a] = box_lo;
+            dst.exponent[a] = int8_t(e);
+            double scale = std::ldexp(1.0, e);
+            for (uint32_t i = 0; i < src.count; i++) {
+                double qlo = std::floor((double(lo[a][i]) - box_lo) / scale);
+                double qhi = std::ceil((double(hi[a][i]) - box_lo) / scale);
+                dst.q[a][i] = uint8_t(std::min(255.0, std::max(0.0, qlo)));
+                dst.q[a + 3][i] = uint8_t(std::min(255.0, std::max(0.0, qhi)));
+            }
+        }
+        for (uint32_t i = 0; i < src.count; i++) dst.child[i] = src.child[i];
+    }
+
+    // slab test against the four dequantized child boxes; the child plane
+    // distance is t = q * (scale * inv_dir) + (origin - orig) * inv_dir
+    static unsigned intersect(const node& n, const float_ray& fr, float tmin, float tmax, float* tnear) {
+        float a[3], b[3];
+        for (int k = 0; k < 3; k++) {
+            a[k] = exp2i(n.exponent[k]) * fr.inv[k];
+            b[k] = (n.origin[k] - fr.o[k]) * fr.inv[k];
+        }
+        unsigned mask = 0;
+#if defined(BVH_WIDE_SSE)
+        __m128 t0[3], t1[3];
+        for (int k = 0; k < 3; k++) {
+            __m128 va = _mm_set1_ps(a[k]), vb = _mm_set1_ps(b[k]);
+            t0[k] = _mm_add_ps(_mm_mul_ps(dequantize(n.q[k]), va), vb);
+            t1[k] = _mm_add_ps(_mm_mul_ps(dequantize(n.q[k + 3]), va), vb);
+        }
+        __m128 tn = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0[0], t1[0]), _mm_min_ps(t0[1], t1[1])),
+                               _mm_max_ps(_mm_min_ps(t0[2], t1[2]), _mm_set1_ps(tmin)));
+        __m128 tf = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0[0], t1[0]), _mm_max_ps(t0[1], t1[1])),
+                               _mm_min_ps(_mm_max_ps(t0[2], t1[2]), _mm_set1_ps(tmax)));
+        _mm_store_ps(tnear, tn);
+        mask = unsigned(_mm_movemask_ps(_mm_cmple_ps(tn, tf)));
+#else
+        for (int i = 0; i < 4; i++) {
+            float tn = tmin, tf = tmax;
+            for (int k = 0; k < 3; k++) {
+                float t0 = n.q[k][i] * a[k] + b[k];
+                float t1 = n.q[k + 3][i] * a[k] + b[k];
+                tn = std::max(tn, std::min(t0, t1));
+                tf = std::min(tf, std::max(t0, t1));
+            }
+            tnear[i] = tn;
+            if (tn <= tf) mask |= 1u << i;
+        }
+#endif
+        return mask & ((1u << n.count) - 1);
+    }
+
+#if defined(BVH_WIDE_SSE)
+    // four unsigned bytes to four floats
+    static __m128 dequantize(const uint8_t* q) {
+        int32_t packed;
+        std::memcpy(&packed, q, sizeof(packed));
+        __m128i zero = _mm_setzero_si128();
+        __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+    }
+#endif
+};
+
+#endif
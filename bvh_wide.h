@@ -0,0 +1,507 @@
+#ifndef BVH_WIDE_H
+#define BVH_WIDE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define BVH_WIDE_SSE 1
+#endif
+
+#include "aabb.h"
+#include "accelerator.h"
+#include "bvh.h"
+#include "primitive.h"
+
+class mapped_file;
+
+// Wide BVH with W = 4 or 8 children per node, made by collapsing the binary LBVH:
+// every wide node pulls up grandchildren of its largest internal child until it
+// has W children. Child bounds are stored as float SoA rows so a single SIMD
+// slab test checks the ray against all children, which are then visited
+// nearest first.
+template <int W>
+class wide_bvh : public accelerator {
+    static_assert(W == 4 || W == 8, "wide_bvh supports 4 or 8 children per node");
+public:
+    static constexpr uint32_t LEAF_BIT = bvh::LEAF_BIT;
+
+    struct alignas(32) node {
+        float lo_x[W], lo_y[W], lo_z[W];
+        float hi_x[W], hi_y[W], hi_z[W];
+        uint32_t child[W]; // LEAF_BIT set: index into prims, otherwise into nodes
+        uint32_t count;    // used child slots, always packed at the front
+    };
+
+    explicit wide_bvh(const std::vector<primitive*>& scene) : wide_bvh(bvh(scene)) {}
+
+    explicit wide_bvh(const bvh& binary)
+        : prims(binary.get_prims()), unbounded(binary.get_unbounded())
+    {
+        if (prims.empty()) return;
+        nodes.reserve(binary.get_nodes().size() / (W / 2) + 1);
+        if (binary.get_root() & LEAF_BIT) {
+            // single primitive, wrap it in a one-child node
+            aabb box;
+            prims[0]->bounding_box(box);
+            nodes.emplace_back();
+            set_slot(nodes[0], 0, binary.get_root(), box);
+            nodes[0].count = 1;
+        } else {
+            collapse(binary, binary.get_root());
+        }
+        node_data = nodes.data();
+        node_count = nodes.size();
+    }
+
+    // uses nodes that live in a mapped acceleration structure cache
+    wide_bvh(std::shared_ptr<const mapped_file> mapping, const node* data, size_t count,
+             std::vector<primitive*> prims, std::vector<primitive*> unbounded)
+        : prims(std::move(prims)), unbounded(std::move(unbounded)),
+          node_data(data), node_count(count), mapping(std::move(mapping)) {}
+
+    // node_data may point into the owned node vector
+    wide_bvh(const wide_bvh&) = delete;
+    wide_bvh& operator=(const wide_bvh&) = delete;
+
+    static const char* cache_kind() { return W == 4 ? "bvh4" : "bvh8"; }
+
+    bool closest_hit(const ray& r, real tmin, real tmax, hit_struct& hit_out) const override {
+        bool hit_any = false;
+        hit_struct tmp;
+        for (auto* obj : unbounded) {
+            if (obj->hit(r, tmin, tmax, tmp)) {
+                hit_out = tmp;
+                tmax = tmp.t;
+                hit_any = true;
+            }
+        }
+        if (node_count == 0) return hit_any;
+
+        float_ray fr(r);
+        struct entry { uint32_t ref; float t; };
+        entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = {0, -INFINITY};
+
+        while (top > 0) {
+            entry e = stack[--top];
+            if (e.t > round_up(tmax)) continue; // entered beyond the current closest hit
+
+            if (e.ref & LEAF_BIT) {
+                primitive* obj = prims[e.ref & ~LEAF_BIT];
+                if (obj->hit(r, tmin, tmax, tmp)) {
+                    hit_out = tmp;
+                    tmax = tmp.t;
+                    hit_any = true;
+                }
+                continue;
+            }
+
+            const node& n = node_data[e.ref];
+            COUNT_NODE_VISIT();
+
+            alignas(32) float tnear[W];
+            unsigned mask = intersect(n, fr, round_down(tmin), round_up(tmax), tnear);
+
+            // insertion sort the hit children by entry distance, farthest first,
+            // then push them so the nearest one ends up on top of the stack
+            entry hits[W];
+            int count = 0;
+            for (; mask; mask &= mask - 1) {
+                int lane = lowest_bit(mask);
+                entry h = {n.child[lane], tnear[lane]};
+                int k = count++;
+                while (k > 0 && hits[k - 1].t < h.t) {
+                    hits[k] = hits[k - 1];
+                    k--;
+                }
+                hits[k] = h;
+            }
+            for (int k = 0; k < count; k++) stack[top++] = hits[k];
+        }
+        return hit_any;
+    }
+
+    bool occluded(const ray& r, real tmin, real tmax) const override {
+        for (auto* obj : unbounded)
+            if (obj->any_hit(r, tmin, tmax)) return true;
+        if (node_count == 0) return false;
+
+        float_ray fr(r);
+        float ftmin = round_down(tmin), ftmax = round_up(tmax);
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            uint32_t ref = stack[--top];
+            if (ref & LEAF_BIT) {
+                if (prims[ref & ~LEAF_BIT]->any_hit(r, tmin, tmax)) return true;
+                continue;
+            }
+            const node& n = node_data[ref];
+            COUNT_NODE_VISIT();
+            alignas(32) float tnear[W];
+            for (unsigned mask = intersect(n, fr, ftmin, ftmax, tnear); mask; mask &= mask - 1)
+                stack[top++] = n.child[lowest_bit(mask)];
+        }
+        return false;
+    }
+
+    // Batches are traced in packets of up to STREAM_PACKET rays that walk the
+    // tree together: a popped node is loaded once and slab tested for every ray
+    // still active in its entry, and each child is pushed with the mask of the
+    // rays that hit it. Rays keep their own tmax, so a packet finds the same
+    // closest hits as tracing its rays one by one.
+    void closest_hit_stream(const ray* rays, size_t count, real tmin, const real* tmax,
+                            hit_struct* hits_out, unsigned char* hit) const override {
+        for (size_t first = 0; first < count; first += STREAM_PACKET) {
+            size_t n = std::min(count - first, size_t(STREAM_PACKET));
+            closest_hit_packet(rays + first, n, tmin, tmax + first, hits_out + first, hit + first);
+        }
+    }
+
+    void occluded_stream(const ray* rays, size_t count, real tmin, const real* tmax,
+                         unsigned char* blocked) const override {
+        for (size_t first = 0; first < count; first += STREAM_PACKET) {
+            size_t n = std::min(count - first, size_t(STREAM_PACKET));
+            occluded_packet(rays + first, n, tmin, tmax + first, blocked + first);
+        }
+    }
+
+    size_t memory_bytes() const override {
+        return node_count * sizeof(node) + (prims.size() + unbounded.size()) * sizeof(primitive*);
+    }
+
+    const node* get_nodes() const { return node_data; }
+    size_t get_node_count() const { return node_count; }
+    const std::vector<primitive*>& get_prims() const { return prims; }
+    const std::vector<primitive*>& get_unbounded() const { return unbounded; }
+
+private:
+    // the binary tree is at most 64 levels deep and each wide level pushes at most W
+    static constexpr int STACK_SIZE = 64 * W;
+    // rays per packet of the stream traversals, one bit each in a packet mask
+    static constexpr int STREAM_PACKET = 64;
+
+    std::vector<node> nodes; // depth-first order, nodes[0] is the root, empty when mapped
+    std::vector<primitive*> prims;
+    std::vector<primitive*> unbounded;
+    const node* node_data = nullptr;
+    size_t node_count = 0;
+    std::shared_ptr<const mapped_file> mapping; // keeps mapped nodes alive
+
+    // ray origin and reciprocal direction in single precision
+    struct float_ray {
+        float ox, oy, oz;
+        float ix, iy, iz;
+        float_ray() = default;
+        explicit float_ray(const ray& r)
+            : ox(float(r.origin().x())), oy(float(r.origin().y())), oz(float(r.origin().z())),
+              ix(float(1.0 / r.direction().x())), iy(float(1.0 / r.direction().y())), iz(float(1.0 / r.direction().z())) {}
+    };
+
+    static int lowest_bit(unsigned mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz(mask);
+#else
+        int i = 0;
+        while (!(mask & 1u)) { mask >>= 1; i++; }
+        return i;
+#endif
+    }
+
+    static int lowest_bit(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(mask);
+#else
+        int i = 0;
+        while (!(mask & 1u)) { mask >>= 1; i++; }
+        return i;
+#endif
+    }
+
+    static uint64_t packet_mask(size_t n) { return n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1; }
+
+    // closest_hit for n <= STREAM_PACKET rays at once
+    void closest_hit_packet(const ray* rays, size_t n, real tmin, const real* tmax,
+                            hit_struct* hits_out, unsigned char* hit) const {
+        real ray_tmax[STREAM_PACKET];
+        hit_struct tmp;
+        for (size_t k = 0; k < n; k++) {
+            hit[k] = 0;
+            ray_tmax[k] = tmax[k];
+            for (auto* obj : unbounded) {
+                if (obj->hit(rays[k], tmin, ray_tmax[k], tmp)) {
+                    hits_out[k] = tmp;
+                    ray_tmax[k] = tmp.t;
+                    hit[k] = 1;
+                }
+            }
+        }
+        if (node_count == 0) return;
+
+        float_ray fr[STREAM_PACKET];
+        float ftmax[STREAM_PACKET];
+        for (size_t k = 0; k < n; k++) {
+            fr[k] = float_ray(rays[k]);
+            ftmax[k] = round_up(ray_tmax[k]);
+        }
+        float ftmin = round_down(tmin);
+
+        struct entry { uint32_t ref; uint64_t rays; };
+        entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = {0, packet_mask(n)};
+
+        while (top > 0) {
+            entry e = stack[--top];
+            if (e.ref & LEAF_BIT) {
+                primitive* obj = prims[e.ref & ~LEAF_BIT];
+                for (uint64_t active = e.rays; active; active &= active - 1) {
+                    int k = lowest_bit(active);
+                    if (obj->hit(rays[k], tmin, ray_tmax[k], tmp)) {
+                        hits_out[k] = tmp;
+                        ray_tmax[k] = tmp.t;
+                        ftmax[k] = round_up(tmp.t);
+                        hit[k] = 1;
+                    }
+                }
+                continue;
+            }
+
+            const node& nd = node_data[e.ref];
+            COUNT_NODE_VISIT();
+            uint64_t child_rays[W] = {};
+            float child_t[W]; // nearest entry over the rays that hit the child
+            for (int c = 0; c < W; c++) child_t[c] = INFINITY;
+            for (uint64_t active = e.rays; active; active &= active - 1) {
+                int k = lowest_bit(active);
+                alignas(32) float tnear[W];
+                for (unsigned mask = intersect(nd, fr[k], ftmin, ftmax[k], tnear); mask; mask &= mask - 1) {
+                    int lane = lowest_bit(mask);
+                    child_rays[lane] |= uint64_t(1) << k;
+                    child_t[lane] = std::min(child_t[lane], tnear[lane]);
+                }
+            }
+            push_nearest_last(nd, child_rays, child_t, stack, top);
+        }
+    }
+
+    // occluded for n <= STREAM_PACKET rays at once, a ray leaves the packet
+    // as soon as it is blocked
+    void occluded_packet(const ray* rays, size_t n, real tmin, const real* tmax, unsigned char* blocked) const {
+        uint64_t open = 0; // rays not blocked yet
+        for (size_t k = 0; k < n; k++) {
+            blocked[k] = 0;
+            for (auto* obj : unbounded) {
+                if (obj->any_hit(rays[k], tmin, tmax[k])) {
+                    blocked[k] = 1;
+                    break;
+                }
+            }
+            if (!blocked[k]) open |= uint64_t(1) << k;
+        }
+        if (node_count == 0 || open == 0) return;
+
+        float_ray fr[STREAM_PACKET];
+        float ftmax[STREAM_PACKET];
+        for (size_t k = 0; k < n; k++) {
+            fr[k] = float_ray(rays[k]);
+            ftmax[k] = round_up(tmax[k]);
+        }
+        float ftmin = round_down(tmin);
+
+        struct entry { uint32_t ref; uint64_t rays; };
+        entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = {0, open};
+
+        while (top > 0 && open) {
+            entry e = stack[--top];
+            uint64_t active = e.rays & open;
+            if (!active) continue;
+            if (e.ref & LEAF_BIT) {
+                primitive* obj = prims[e.ref & ~LEAF_BIT];
+                for (; active; active &= active - 1) {
+                    int k = lowest_bit(active);
+                    if (obj->any_hit(rays[k], tmin, tmax[k])) {
+                        blocked[k] = 1;
+                        open &= ~(uint64_t(1) << k);
+                    }
+                }
+                continue;
+            }
+
+            const node& nd = node_data[e.ref];
+            COUNT_NODE_VISIT();
+            uint64_t child_rays[W] = {};
+            for (; active; active &= active - 1) {
+                int k = lowest_bit(active);
+                alignas(32) float tnear[W];
+                for (unsigned mask = intersect(nd, fr[k], ftmin, ftmax[k], tnear); mask; mask &= mask - 1)
+                    child_rays[lowest_bit(mask)] |= uint64_t(1) << k;
+            }
+            for (int c = 0; c < W; c++)
+                if (child_rays[c]) stack[top++] = {nd.child[c], child_rays[c]};
+        }
+    }
+
+    // pushes the children some ray hit, farthest first so the nearest is popped next
+    template <typename Entry>
+    static void push_nearest_last(const node& nd, const uint64_t* child_rays, const float* child_t,
+                                  Entry* stack, int& top) {
+        int order[W];
+        int count = 0;
+        for (int c = 0; c < W; c++) {
+            if (!child_rays[c]) continue;
+            int k = count++;
+            while (k > 0 && child_t[order[k - 1]] < child_t[c]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = c;
+        }
+        for (int k = 0; k < count; k++) stack[top++] = {nd.child[order[k]], child_rays[order[k]]};
+    }
+
+    static float round_down(double v) {
+        float f = float(v);
+        return double(f) > v ? std::nextafter(f, -INFINITY) : f;
+    }
+
+    static float round_up(double v) {
+        float f = float(v);
+        return double(f) < v ? std::nextafter(f, INFINITY) : f;
+    }
+
+    // slab test of the ray against all children, returns the bit mask of the hit
+    // ones and stores their entry distances in tnear
+    static unsigned intersect(const node& n, const float_ray& fr, float tmin, float tmax, float* tnear) {
+        unsigned mask = 0;
+#if defined(__AVX__)
+        if (W == 8) {
+            __m256 ox = _mm256_set1_ps(fr.ox), oy = _mm256_set1_ps(fr.oy), oz = _mm256_set1_ps(fr.oz);
+            __m256 ix = _mm256_set1_ps(fr.ix), iy = _mm256_set1_ps(fr.iy), iz = _mm256_set1_ps(fr.iz);
+            __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.lo_x), ox), ix);
+            __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.hi_x), ox), ix);
+            __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.lo_y), oy), iy);
+            __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.hi_y), oy), iy);
+            __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.lo_z), oz), iz);
+            __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.hi_z), oz), iz);
+            __m256 tn = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+                                      _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_set1_ps(tmin)));
+            __m256 tf = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+                                      _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(tmax)));
+            _mm256_store_ps(tnear, tn);
+            mask = unsigned(_mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ)));
+            return mask & ((1u << n.count) - 1);
+        }
+#endif
+#if defined(BVH_WIDE_SSE)
+        __m128 ox = _mm_set1_ps(fr.ox), oy = _mm_set1_ps(fr.oy), oz = _mm_set1_ps(fr.oz);
+        __m128 ix = _mm_set1_ps(fr.ix), iy = _mm_set1_ps(fr.iy), iz = _mm_set1_ps(fr.iz);
+        __m128 vmin = _mm_set1_ps(tmin), vmax = _mm_set1_ps(tmax);
+        for (int g = 0; g < W; g += 4) {
+            __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.lo_x + g), ox), ix);
+            __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.hi_x + g), ox), ix);
+            __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.lo_y + g), oy), iy);
+            __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.hi_y + g), oy), iy);
+            __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.lo_z + g), oz), iz);
+            __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.hi_z + g), oz), iz);
+            __m128 tn = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                   _mm_max_ps(_mm_min_ps(t0z, t1z), vmin));
+            __m128 tf = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                   _mm_min_ps(_mm_max_ps(t0z, t1z), vmax));
+            _mm_store_ps(tnear + g, tn);
+            mask |= unsigned(_mm_movemask_ps(_mm_cmple_ps(tn, tf))) << g;
+        }
+#else
+        for (int i = 0; i < W; i++) {
+            float t0x = (n.lo_x[i] - fr.ox) * fr.ix, t1x = (n.hi_x[i] - fr.ox) * fr.ix;
+            float t0y = (n.lo_y[i] - fr.oy) * fr.iy, t1y = (n.hi_y[i] - fr.oy) * fr.iy;
+            float t0z = (n.lo_z[i] - fr.oz) * fr.iz, t1z = (n.hi_z[i] - fr.oz) * fr.iz;
+            float tn = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), tmin));
+            float tf = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), tmax));
+            tnear[i] = tn;
+            if (tn <= tf) mask |= 1u << i;
+        }
+#endif
+        return mask & ((1u << n.count) - 1);
+    }
+
+    // rounds outward and pads by the error of a float ray origin so the
+    // single precision slab test never misses a box the double one would hit
+    static void set_slot(node& n, int lane, uint32_t ref, const aabb& box) {
+        double mag = 1.0;
+        for (int a = 0; a < 3; a++)
+            mag = std::max(mag, double(std::max(std::abs(box.lo[a]), std::abs(box.hi[a]))));
+        double pad = 1e-6 * mag;
+        n.lo_x[lane] = round_down(box.lo.x() - pad);
+        n.lo_y[lane] = round_down(box.lo.y() - pad);
+        n.lo_z[lane] = round_down(box.lo.z() - pad);
+        n.hi_x[lane] = round_up(box.hi.x() + pad);
+        n.hi_y[lane] = round_up(box.hi.y() + pad);
+        n.hi_z[lane] = round_up(box.hi.z() + pad);
+        n.child[lane] = ref;
+    }
+
+    // emits the wide node for binary node bin_node and its subtree, returns its index
+    uint32_t collapse(const bvh& binary, uint32_t bin_node) {
+        uint32_t index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        struct slot { uint32_t ref; aabb box; };
+        const auto& bin_nodes = binary.get_nodes();
+        slot slots[W];
+        int count = 2;
+        slots[0] = {bin_nodes[bin_node].child[0], bin_nodes[bin_node].child_box[0]};
+        slots[1] = {bin_nodes[bin_node].child[1], bin_nodes[bin_node].child_box[1]};
+
+        // open the internal child with the largest surface area until the node is full
+        while (count < W) {
+            int best = -1;
+            double best_area = -1;
+            for (int i = 0; i < count; i++) {
+                if (slots[i].ref & LEAF_BIT) continue;
+                double area = slots[i].box.surface_area();
+                if (area > best_area) {
+                    best_area = area;
+                    best = i;
+                }
+            }
+            if (best < 0) break;
+            const auto& opened = bin_nodes[slots[best].ref];
+            slots[best] = {opened.child[0], opened.child_box[0]};
+            slots[count++] = {opened.child[1], opened.child_box[1]};
+        }
+
+        uint32_t refs[W];
+        for (int i = 0; i < count; i++)
+            refs[i] = (slots[i].ref & LEAF_BIT) ? slots[i].ref : collapse(binary, slots[i].ref);
+
+        // nodes may have been reallocated by the recursion above
+        node& n = nodes[index];
+        for (int i = 0; i < W; i++) {
+            if (i < count) {
+                set_slot(n, i, refs[i], slots[i].box);
+            } else {
+                n.lo_x[i] = n.lo_y[i] = n.lo_z[i] = 0.0f;
+                n.hi_x[i] = n.hi_y[i] = n.hi_z[i] = 0.0f;
+                n.child[i] = 0;
+            }
+        }
+        n.count = uint32_t(count);
+        return index;
+    }
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif
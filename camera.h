@@ -1,6 +1,3 @@
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
 #ifndef CAMERA_H
 #define CAMERA_H
 
@@ -8,21 +5,131 @@
 #include <string>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
 
 #include "ray.h"
 #include "primitive.h"
+#include "plane.h"
+#include "accelerator.h"
 #include "color.h"
 #include "light_source.h"
-#include "spotlight.h"
+#include "light_table.h"
+#include "parallel.h"
+#include "rng.h"
+#include "morton.h"
+#include "aabb.h"
+#include "framebuffer.h"
+#include "postprocess.h"
+#include "render_stats.h"
+#include "heatmap.h"
+#include "image_write.h"
 
 // custom utility functions
 #include "util.h"
 
-#include <cstdlib> // for rand()
-#include <ctime>   // for seeding rand()
+#include <ctime>   // for seeding the jitter
 
 
 #define AA_JITTER_REDUCTION 3
+#define WAVEFRONT_TILE 32 // tile edge in pixels, one tile is one batch of rays
+
+#define RAY_ORDER_INDEX_BITS 31 // the octant and a 30-bit Morton code take the 33 bits above
+
+// Coherent trace order of a batch of rays, each entry having an origin and a
+// dir. Rays are sorted by the octant of their direction, then by the Morton
+// code of their origin within the batch bounds, so consecutive rays start
+// close together, head the same way and walk mostly the same nodes.
+// order_out gets octant << 61 | Morton code << 31 | index into batch, sorted.
+template <typename Entry>
+void order_ray_batch(const std::vector<Entry>& batch, std::vector<uint64_t>& order_out) {
+    if (batch.size() >= (size_t(1) << RAY_ORDER_INDEX_BITS))
+        throw std::length_error("Ray batch too large to order");
+    aabb bounds;
+    for (const auto& e : batch) bounds.grow(e.origin);
+    vec3 ext = bounds.extent();
+    vec3 inv(ext.x() > 0 ? 1 / ext.x() : 0, ext.y() > 0 ? 1 / ext.y() : 0, ext.z() > 0 ? 1 / ext.z() : 0);
+    order_out.resize(batch.size());
+    for (size_t k = 0; k < batch.size(); k++) {
+        const Entry& e = batch[k];
+        vec3 rel = (e.origin - bounds.lo) * inv;
+        uint64_t octant = (e.dir.x() < 0 ? 4u : 0u) | (e.dir.y() < 0 ? 2u : 0u) | (e.dir.z() < 0 ? 1u : 0u);
+        uint64_t key = (octant << 30) | morton3d(rel.x(), rel.y(), rel.z());
+        order_out[k] = (key << RAY_ORDER_INDEX_BITS) | k;
+    }
+    std::sort(order_out.begin(), order_out.end());
+}
+
+// index into the batch of an order_ray_batch entry
+inline size_t ray_order_index(uint64_t entry) { return size_t(entry & ((uint64_t(1) << RAY_ORDER_INDEX_BITS) - 1)); }
+
+// A render_tiles call as other threads see it: a cancel flag checked before
+// each tile, the count of finished tiles with a callback after each one, and
+// the image, whose finished tiles can be copied out while others are written.
+class tile_render {
+public:
+    tile_render(int width, int height)
+        : tiles_x((width + WAVEFRONT_TILE - 1) / WAVEFRONT_TILE),
+          total(size_t(tiles_x) * ((height + WAVEFRONT_TILE - 1) / WAVEFRONT_TILE)),
+          finished(total), image(width, height) {}
+
+    tile_render(const tile_render&) = delete;
+    tile_render& operator=(const tile_render&) = delete;
+
+    /// called on a render thread after each tile, possibly from several at once
+    std::function<void(size_t done, size_t total)> progress;
+
+    /// no tile is started after this, tiles in progress are finished
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+    size_t tiles_done() const { return done.load(); }
+    size_t tiles_total() const { return total; }
+
+    /// the finished tiles, the others black; never waits for the render
+    /// @throws std::logic_error once the image was taken
+    framebuffer snapshot() const {
+        if (taken.load(std::memory_order_acquire)) throw std::logic_error("Tile render image was already taken");
+        framebuffer copy(image.width(), image.height());
+        for (size_t t = 0; t < total; t++) {
+            if (!finished[t].load(std::memory_order_acquire)) continue;
+            int x0 = tile_x0(t), y0 = tile_y0(t);
+            int x1 = std::min(x0 + WAVEFRONT_TILE, image.width());
+            int y1 = std::min(y0 + WAVEFRONT_TILE, image.height());
+            for (int j = y0; j < y1; j++) {
+                size_t row = (size_t(j) * image.width() + x0) * 3;
+                std::copy(image.data() + row, image.data() + row + size_t(x1 - x0) * 3, copy.data() + row);
+            }
+        }
+        return copy;
+    }
+
+    /// moves the image out once render_tiles has returned, only once
+    /// @throws std::logic_error when it was taken before
+    framebuffer take_image() {
+        if (taken.exchange(true)) throw std::logic_error("Tile render image was already taken");
+        return std::move(image);
+    }
+
+private:
+    friend class camera;
+    int tiles_x;
+    size_t total;
+    std::atomic<bool> cancelled{false};
+    std::atomic<size_t> done{0};
+    std::atomic<bool> taken{false}; // image was moved out
+    std::vector<std::atomic<bool>> finished; // per tile, set once its pixels are written
+    framebuffer image; // tiles are written by one thread each and read once finished
+
+    int tile_x0(size_t t) const { return int(t % tiles_x) * WAVEFRONT_TILE; }
+    int tile_y0(size_t t) const { return int(t / tiles_x) * WAVEFRONT_TILE; }
+};
 
 // camera always looks at center of z=0 plane
 // where the right up corner is (1,1,0) and bottom left is (-1,-1,0)
@@ -32,20 +139,200 @@ public:
     camera(const point3& origin, int px_height, int px_width, color background)
         : orig(origin), height(px_height), width(px_width), bg_color(background){}
 
-    void render(const std::vector<primitive*>& scene, 
-                const std::vector<light_source*>& lights,
-                const color& ambient,
-                const std::string& output_file_name,
-                const int aa_samples = 1, const double gamma_value = 1)
+    /// orders each wavefront shadow batch by ray direction octant and origin
+    /// Morton code before tracing, on by default
+    void set_shadow_ray_sorting(bool enabled) { sort_shadow_rays = enabled; }
+
+    /// seeds the anti-aliasing jitter with a fixed value so the same scene always
+    /// gives the same image, by default the seed is taken from the clock
+    void set_seed(uint32_t value) {
+        seed_fixed = true;
+        fixed_seed = value;
+    }
+
+    /// also writes the time spent on each tile as a false-colour image to path,
+    /// or on each pixel with per_pixel (render_image only, tiles are always timed whole)
+    void set_cost_heatmap(const std::string& path, bool per_pixel = false) {
+        heatmap_path = path;
+        heatmap_per_pixel = per_pixel;
+    }
+
+    /// where the heatmap and traversal stats summaries go, nowhere by default
+    void set_log(std::function<void(const std::string&)> log) { log_line = std::move(log); }
+
+    /// the image in linear colors before the post pass, scanline by scanline
+    /// @param progress  scanlines done and in total, called after each one
+    framebuffer render_image(const accelerator& scene,
+                             const std::vector<light_source*>& lights,
+                             const color& ambient,
+                             const int aa_samples = 1,
+                             const std::function<void(size_t done, size_t total)>& progress = nullptr) const
     {
         // get random value for jittering
-        std::srand(static_cast<unsigned int>(std::time(nullptr)));
+        uint32_t seed = jitter_seed();
+        light_table table(lights);
+
+        // linear colors, turned into 8-bit pixels by the post pass
+        framebuffer image(width, height);
+
+        // time is only taken per run of pixels inside one heatmap cell
+        std::unique_ptr<cost_heatmap> costs = make_heatmap(heatmap_per_pixel ? 1 : WAVEFRONT_TILE);
+        int run = costs ? costs->get_cell() : width;
+
+        // Render
+        scoped_phase timer("render");
+        for (int j = 0; j < height; j++) {
+            trace_span span("scanline");
+            for (int i0 = 0; i0 < width; i0 += run) {
+                uint64_t start = costs ? now_ns() : 0;
+                for (int i = i0; i < std::min(i0 + run, width); i++)
+                    render_pixel(scene, table, ambient, aa_samples, seed, i, j, image);
+                if (costs) costs->add(i0, j, now_ns() - start);
+            }
+            if (progress) progress(size_t(j) + 1, size_t(height));
+        }
+        timer.stop();
+
+        if (costs) write_heatmap(*costs);
+        return image;
+    }
 
-        // for output
-        std::vector<unsigned char> image(width * height * 3);
+    /// color seen along one primary ray, what render computes per sample
+    color trace(const ray& r, const accelerator& scene, const light_table& lights, const color& ambient) const {
+        return shade(r, get_min_intersection(r, scene, INFINITY), scene, lights, ambient);
+    }
+
+    // Same image as render_image, computed a tile at a time in stages over the
+    // whole tile: all primary rays are generated and intersected, then for each
+    // light all shadow rays are intersected, then shading is accumulated. Each
+    // stage runs one kind of work over a large batch, and tiles run in parallel.
+    /// @param progress  tiles done and in total, called on the render threads after each tile
+    framebuffer render_wavefront_image(const accelerator& scene,
+                                       const std::vector<light_source*>& lights,
+                                       const color& ambient,
+                                       const int aa_samples = 1,
+                                       std::function<void(size_t done, size_t total)> progress = nullptr) const
+    {
+        tile_render tiles(width, height);
+        tiles.progress = std::move(progress);
+        render_tiles(scene, light_table(lights), ambient, aa_samples, true, tiles);
+        return tiles.take_image();
+    }
+
+    /// Renders into tiles a tile at a time, tiles running in parallel, with the
+    /// stages of render_wavefront_image or, without wavefront, pixel by pixel
+    /// like render_image. Other threads can watch, copy or cancel the render through tiles.
+    /// @return false when it was cancelled before every tile was done
+    bool render_tiles(const accelerator& scene,
+                      const light_table& table,
+                      const color& ambient,
+                      int aa_samples, bool wavefront,
+                      tile_render& tiles) const
+    {
+        if (tiles.image.width() != width || tiles.image.height() != height)
+            throw std::runtime_error("Tile render is not the size of the camera");
+        uint32_t seed = jitter_seed();
+        std::unique_ptr<cost_heatmap> costs = make_heatmap(WAVEFRONT_TILE);
+        size_t count = tiles.total;
+
+        // tiles are handed out one at a time so threads stay busy until the end
+        std::atomic<size_t> next_tile{0};
+        std::atomic<uint64_t> shadow_rays{0}, shadow_visits{0};
+        scoped_phase timer("render");
+        // a tile that throws, or its progress callback, stops the others;
+        // parallel_chunks rethrows once every thread is done
+        parallel_chunks(count, chunk_count(count, 1), [&](unsigned, size_t, size_t) {
+            wavefront_queues q;
+            for (size_t t; !tiles.is_cancelled() && (t = next_tile++) < count;) {
+                try {
+                    int x0 = tiles.tile_x0(t);
+                    int y0 = tiles.tile_y0(t);
+                    trace_span span("tile");
+                    uint64_t start = costs ? now_ns() : 0;
+                    if (wavefront) render_tile(scene, table, ambient, aa_samples, seed, x0, y0, q, tiles.image);
+                    else render_tile_pixels(scene, table, ambient, aa_samples, seed, x0, y0, tiles.image);
+                    if (costs) costs->add(x0, y0, now_ns() - start);
+
+                    tiles.finished[t].store(true, std::memory_order_release);
+                    size_t done = ++tiles.done;
+                    if (tiles.progress) tiles.progress(done, count);
+                } catch (...) {
+                    tiles.cancel();
+                    throw;
+                }
+            }
+            shadow_rays += q.shadow_rays_traced;
+            shadow_visits += q.shadow_node_visits;
+        });
+        timer.stop();
+
+        if (costs) write_heatmap(*costs);
+#ifdef HW2_TRAVERSAL_STATS
+        if (wavefront && log_line) {
+            std::ostringstream line;
+            line << "Shadow rays: " << shadow_rays << ", nodes visited per shadow ray: "
+                 << (shadow_rays ? double(shadow_visits) / double(shadow_rays) : 0.0);
+            log_line(line.str());
+        }
+#endif
+        return tiles.done == count;
+    }
 
+private:
+    point3 orig;
+    int height;
+    int width;
+    color bg_color;
+    bool sort_shadow_rays = true;
+    std::string heatmap_path; // empty: no heatmap
+    bool heatmap_per_pixel = false;
+    std::function<void(const std::string&)> log_line; // empty: summaries are dropped
+    bool seed_fixed = false;
+    uint32_t fixed_seed = 0;
+
+    // what shading needs to know about a hit point
+    struct surface {
+        point3 P;
+        vec3 N;          // flipped toward the light for planes
+        vec3 V;          // view direction
+        color base;      // color at P
+        const specular_power* specular; // x^shininess of the material
+        bool two_sided;  // planes are lit from both sides
+    };
+
+    // a queued shadow ray and what to add if it is not blocked
+    struct shadow_entry {
+        uint32_t surface;
+        point3 origin;
+        real tmax;
+        vec3 dir;
+        color li;
+    };
+
+    // ray batches of one tile, kept per thread and reused for every tile
+    struct wavefront_queues {
+        std::vector<ray> rays;            // primary rays, samples of a pixel are consecutive
+        std::vector<real> tmax;
+        std::vector<hit_struct> hits;
+        std::vector<unsigned char> hit;
+        std::vector<color> radiance;      // per primary ray
+        std::vector<surface> surfaces;    // per primary ray that hit
+        std::vector<uint32_t> surface_ray; // primary ray of each surface
+
+        std::vector<shadow_entry> shadow; // one light, surfaces the light can reach
+        std::vector<uint64_t> shadow_order; // see order_ray_batch, index into shadow in the low bits
+        std::vector<ray> shadow_rays;     // in trace order
+        std::vector<real> shadow_tmax;
+        std::vector<unsigned char> blocked;
+
+        uint64_t shadow_rays_traced = 0;  // only counted with HW2_TRAVERSAL_STATS
+        uint64_t shadow_node_visits = 0;
+    };
+
+    // jittered ray through sample (sx, sy) of pixel (i, j)
+    ray sample_ray(int i, int j, int sx, int sy, int samples_per_axis, pixel_rng& rng) const {
         // vectors defining the viewport (-1 to 1)
-        auto screen_u = vec3(2.0, 0, 0); 
+        auto screen_u = vec3(2.0, 0, 0);
         auto screen_v = vec3(0, -2.0, 0);
         auto screen_origin = point3(-1, 1, 0);
 
@@ -58,133 +345,277 @@ public:
         // Calculate from exact center - for antialiasing to work without shifting
         auto pixel_upper_left = screen_origin;
 
-        // Render
-        for (int j = 0; j < height; j++) {
-            std::cout << "\rScanlines remaining: " << (height - j) << ' ' << std::flush;
-            for (int i = 0; i < width; i++) {
-                color pixel_color(0, 0, 0);
-                int samples_per_axis = aa_samples;
-                double inv_samples = 1.0 / (samples_per_axis * samples_per_axis);
-
-                for (int sy = 0; sy < samples_per_axis; ++sy) {
-                    for (int sx = 0; sx < samples_per_axis; ++sx) {
-                        double jitter_x = ((double) std::rand() / RAND_MAX);
-                        double jitter_y = ((double) std::rand() / RAND_MAX);
-
-                        // Proper per-grid jittered sample
-                        double offset_u = (i + (sx + jitter_x / AA_JITTER_REDUCTION) / samples_per_axis);
-                        double offset_v = (j + (sy + jitter_y / AA_JITTER_REDUCTION) / samples_per_axis);
-
-                        auto pixel_sample = pixel_upper_left 
-                            + offset_u * pixel_delta_u 
-                            + offset_v * pixel_delta_v;
-
-                        auto ray_direction = pixel_sample - orig;
-                        ray r(orig, ray_direction);
-                        auto intersection_hit = get_min_intersection(r, scene, INFINITY);
-                        pixel_color += shade(r, intersection_hit, scene, lights, ambient);
-                    }
-                }
-                pixel_color *= inv_samples;
-                // Normalize
-                pixel_color = clamp(pixel_color, 0.0, 1.0);
-
-                // Gamma correction
-                double gamma = 1.0;
-                // correct if power != 1
-                if(gamma != 1.0)
-                    pixel_color = color(
-                        pow(pixel_color.x(),gamma),
-                        pow(pixel_color.y(),gamma),
-                        pow(pixel_color.z(),gamma)
-                    );
-
-                write_color(image, (j * width + i) * 3, pixel_color);
+        COUNT_STAT(STAT_PRIMARY_RAYS);
+        double jitter_x = rng.next();
+        double jitter_y = rng.next();
+
+        // Proper per-grid jittered sample
+        double offset_u = (i + (sx + jitter_x / AA_JITTER_REDUCTION) / samples_per_axis);
+        double offset_v = (j + (sy + jitter_y / AA_JITTER_REDUCTION) / samples_per_axis);
+
+        auto pixel_sample = pixel_upper_left
+            + offset_u * pixel_delta_u
+            + offset_v * pixel_delta_v;
+
+        auto ray_direction = pixel_sample - orig;
+        return ray(orig, ray_direction);
+    }
+
+    // averages the summed samples of pixel (i, j) into the framebuffer,
+    // clamping and gamma are left to the post pass
+    void store_pixel(framebuffer& image, int i, int j, color pixel_color, int samples_per_axis) const {
+        color c = pixel_color * (1.0 / (samples_per_axis * samples_per_axis));
+        float* p = image.pixel(i, j);
+        p[0] = float(c.x());
+        p[1] = float(c.y());
+        p[2] = float(c.z());
+    }
+
+    uint32_t jitter_seed() const { return seed_fixed ? fixed_seed : uint32_t(std::time(nullptr)); }
+
+    std::unique_ptr<cost_heatmap> make_heatmap(int cell) const {
+        if (heatmap_path.empty()) return nullptr;
+        return std::make_unique<cost_heatmap>(width, height, cell);
+    }
+
+    void write_heatmap(const cost_heatmap& costs) const {
+        std::vector<unsigned char> pixels = costs.to_image();
+        write_png_rgb(heatmap_path, width, height, pixels.data());
+        if (!log_line) return;
+        std::ostringstream line;
+        line << "Cost heatmap: " << heatmap_path << ", red is " << double(costs.red_cost()) * 1e-6
+             << " ms or more per " << (costs.get_cell() == 1 ? "pixel" : "tile");
+        log_line(line.str());
+    }
+
+    static uint64_t now_ns() {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // one pixel as render computes it, sample by sample
+    void render_pixel(const accelerator& scene, const light_table& table, const color& ambient,
+                      int samples_per_axis, uint32_t seed, int i, int j, framebuffer& image) const {
+        color pixel_color(0, 0, 0);
+        pixel_rng rng(seed, uint32_t(j * width + i));
+        for (int sy = 0; sy < samples_per_axis; ++sy) {
+            for (int sx = 0; sx < samples_per_axis; ++sx) {
+                ray r = sample_ray(i, j, sx, sy, samples_per_axis, rng);
+                pixel_color += trace(r, scene, table, ambient);
             }
         }
+        store_pixel(image, i, j, pixel_color, samples_per_axis);
+    }
 
-        stbi_write_png(output_file_name.c_str(), width, height, 3, image.data(), width * 3);
-        std::cout << "\rDone.               \n";
+    void render_tile_pixels(const accelerator& scene, const light_table& table, const color& ambient,
+                            int samples_per_axis, uint32_t seed, int x0, int y0, framebuffer& image) const {
+        int x1 = std::min(x0 + WAVEFRONT_TILE, width);
+        int y1 = std::min(y0 + WAVEFRONT_TILE, height);
+        for (int j = y0; j < y1; j++)
+            for (int i = x0; i < x1; i++) render_pixel(scene, table, ambient, samples_per_axis, seed, i, j, image);
     }
 
-private:
-    point3 orig;
-    int height;
-    int width;
-    color bg_color;
+    void render_tile(const accelerator& scene,
+                     const light_table& lights,
+                     const color& ambient,
+                     int samples_per_axis, uint32_t seed, int x0, int y0,
+                     wavefront_queues& q,
+                     framebuffer& image) const
+    {
+        int x1 = std::min(x0 + WAVEFRONT_TILE, width);
+        int y1 = std::min(y0 + WAVEFRONT_TILE, height);
+        int samples = samples_per_axis * samples_per_axis;
+
+        // primary rays
+        q.rays.clear();
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++) {
+                pixel_rng rng(seed, uint32_t(j * width + i));
+                for (int sy = 0; sy < samples_per_axis; ++sy)
+                    for (int sx = 0; sx < samples_per_axis; ++sx)
+                        q.rays.push_back(sample_ray(i, j, sx, sy, samples_per_axis, rng));
+            }
+        }
+        size_t n = q.rays.size();
+        q.tmax.assign(n, INFINITY);
+        q.hits.resize(n);
+        q.hit.resize(n);
+        scene.closest_hit_stream(q.rays.data(), n, 0.001, q.tmax.data(), q.hits.data(), q.hit.data());
+
+        // surfaces and ambient term
+        q.radiance.resize(n);
+        q.surfaces.clear();
+        q.surface_ray.clear();
+        for (size_t k = 0; k < n; k++) {
+            if (!q.hit[k]) {
+                q.radiance[k] = bg_color;
+                continue;
+            }
+            COUNT_STAT(STAT_SHADING_EVALS);
+            q.surfaces.push_back(surface_at(q.rays[k], q.hits[k]));
+            q.surface_ray.push_back(uint32_t(k));
+            q.radiance[k] = ambient * q.surfaces.back().base;
+        }
 
-    // -infinity on hit_out.t means no intersection occured
-    hit_struct get_min_intersection(const ray& r, const std::vector<primitive*>& scene, double tmax) const {
-        hit_struct best;
-        best.t    = tmax;
-        best.prim = nullptr;
+        // one batch of shadow rays per light, in light table order like shade
+        lights.for_each_kind([&](const auto& kind) {
+            for (const auto& L : kind) shadow_stage(scene, L, q);
+        });
 
-        hit_struct tmp;
-        for (auto* obj : scene) {
-            if (obj->hit(r, 0.001, tmax, tmp) && tmp.t < best.t) {
-                best = tmp;
-                best.prim = obj;
+        // resolve, samples of a pixel summed in the same order as render
+        size_t k = 0;
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++) {
+                color pixel_color(0, 0, 0);
+                for (int s = 0; s < samples; s++) pixel_color += q.radiance[k++];
+                store_pixel(image, i, j, pixel_color, samples_per_axis);
             }
         }
+    }
 
-        // If best.prim is still nullptr, there was no hit
-        if (!best.prim) {
-            best.t = -INFINITY;
+    // queues, traces and applies the shadow rays of one light for all surfaces of a tile
+    template <typename Light>
+    void shadow_stage(const accelerator& scene, const Light& L, wavefront_queues& q) const {
+        q.shadow.clear();
+        for (size_t s = 0; s < q.surfaces.size(); s++) {
+            surface& surf = q.surfaces[s];
+            vec3 Ldir;
+            color Li;
+            real tmax;
+            if (!L.illuminate(surf.P, Ldir, Li, tmax)) continue; // adds nothing whether blocked or not
+            face_light(surf, Ldir);
+            q.shadow.push_back({uint32_t(s), offset_origin(surf.P, surf.N), tmax, Ldir, Li});
+        }
+        order_shadow_batch(q);
+
+        size_t m = q.shadow.size();
+        q.shadow_rays.clear();
+        q.shadow_tmax.clear();
+        for (uint64_t o : q.shadow_order) {
+            const shadow_entry& e = q.shadow[ray_order_index(o)];
+            q.shadow_rays.push_back(ray(e.origin, e.dir));
+            q.shadow_tmax.push_back(e.tmax);
+        }
+        q.blocked.resize(m);
+#ifdef HW2_TRAVERSAL_STATS
+        uint64_t visits_before = traversal_node_visits;
+#endif
+        scene.occluded_stream(q.shadow_rays.data(), m, 0.001, q.shadow_tmax.data(), q.blocked.data());
+#ifdef HW2_TRAVERSAL_STATS
+        q.shadow_node_visits += traversal_node_visits - visits_before;
+        q.shadow_rays_traced += m;
+#endif
+        COUNT_STAT_N(STAT_SHADOW_RAYS, m);
+
+        // every surface gets at most one contribution per light, so trace order does not matter here
+        for (size_t k = 0; k < m; k++) {
+            if (q.blocked[k]) {
+                COUNT_STAT(STAT_OCCLUSION_EARLY_OUTS);
+                continue;
+            }
+            const shadow_entry& e = q.shadow[ray_order_index(q.shadow_order[k])];
+            add_light(q.radiance[q.surface_ray[e.surface]], q.surfaces[e.surface], e.dir, e.li);
+        }
+    }
+
+    // trace order of the shadow batch of one light, surface order unless sorting
+    void order_shadow_batch(wavefront_queues& q) const {
+        if (sort_shadow_rays) {
+            order_ray_batch(q.shadow, q.shadow_order);
+            return;
         }
+        q.shadow_order.resize(q.shadow.size());
+        for (size_t k = 0; k < q.shadow.size(); k++) q.shadow_order[k] = k;
+    }
+
+    // moves a shadow ray origin off the surface by an amount that grows with the
+    // coordinates of P, so single precision does not self-shadow far from the origin
+    static point3 offset_origin(const point3& P, const vec3& N) {
+        real m = std::max(std::fabs(P.x()), std::max(std::fabs(P.y()), std::fabs(P.z())));
+        return P + N * (real(1e-4) * std::max(real(1), m));
+    }
+
+    // -infinity on hit_out.t means no intersection occured
+    hit_struct get_min_intersection(const ray& r, const accelerator& scene, real tmax) const {
+        hit_struct best;
+        best.prim = nullptr;
+        if (!scene.closest_hit(r, 0.001, tmax, best))
+            best.t = -INFINITY;
         return best;
     }
 
+    surface surface_at(const ray& r, const hit_struct& hit) const {
+        surface s;
+        hit_surface hs = resolve_hit(r, hit); // only computed for the closest hit
+        s.P = hs.p;
+        s.N = hs.normal; // normal is already normalized
+        s.V = unit_vector(-r.direction()); // view direction
+        s.base = hit.prim->get_color_at(r, hs);
+        s.specular = &hit.prim->get_metrial().specular;
+        s.two_sided = dynamic_cast<const plane*>(hit.prim) != nullptr;
+        return s;
+    }
+
+    // plane will always face lighting
+    static void face_light(surface& s, const vec3& Ldir) {
+        if (s.two_sided && dot(s.N, Ldir) < 0.0)
+            s.N = -s.N;
+    }
+
+    // diffuse and specular from one light that reaches the surface
+    static void add_light(color& result, const surface& s, const vec3& Ldir, const color& Li) {
+        color Ks = color(0.7, 0.7, 0.7); // as defined in our instructions
+
+        // diffuse
+        real NdotL = std::max(dot(s.N, Ldir), real(0));
+        result += s.base * Li * NdotL;
+
+        // specular, nothing to add when R points away from the viewer (0^n = 0 unless n = 0)
+        vec3 R = -Ldir - 2 * dot(-Ldir, s.N) * s.N; // reflected ray direction
+        real RdotV = std::max(dot(R, s.V), real(0));
+        if (RdotV > 0 || s.specular->exponent() == 0)
+            result += Ks * real((*s.specular)(RdotV)) * Li;
+    }
+
     color shade(
         const ray& r,
         const hit_struct& hit,
-        const std::vector<primitive*>& scene,
-        const std::vector<light_source*>& lights,
+        const accelerator& scene,
+        const light_table& lights,
         const color& ambient
-    ) const { 
+    ) const {
         if(hit.t == -INFINITY) return bg_color; // hit nothing, get background color
 
-        vec3 P = hit.p;
-        vec3 N = hit.normal; // normal is already normalized
-        vec3 V = unit_vector(-r.direction()); // view direction
-        
+        COUNT_STAT(STAT_SHADING_EVALS);
+        surface s = surface_at(r, hit);
+
         // ambient
-        color baseColor = hit.prim->get_color_at(r, hit);
-        color result = ambient * baseColor;
+        color result = ambient * s.base;
+
+        // specular + diffuse with shadows, one loop per light type
+        lights.for_each_kind([&](const auto& kind) {
+            for (const auto& L : kind) {
+                vec3 Ldir;
+                color Li;
+                real tmax; // spot lights only check intersections up until the light source
+                if (!L.illuminate(s.P, Ldir, Li, tmax))
+                    continue; // nothing to add whether blocked or not
+                face_light(s, Ldir);
+
+                // check if light hits
+                ray shadow_ray(offset_origin(s.P, s.N), Ldir);
+                COUNT_STAT(STAT_SHADOW_RAYS);
+                if (scene.occluded(shadow_ray, 0.001, tmax)) {
+                    COUNT_STAT(STAT_OCCLUSION_EARLY_OUTS);
+                    continue; // object in way, no light (Si = 0)
+                }
 
-        // specular + diffuse with shadows
-        color Ks = color(0.7, 0.7, 0.7); // as defined in our instructions
-        double shininess = hit.prim->get_metrial().shininess;
-
-        for (auto* L : lights){
-            vec3 Ldir = L->direction(P);
-            if (dynamic_cast<const plane*>(hit.prim) && dot(N, Ldir) < 0.0) // plane will always face lighting
-                N = -N;
-            color Li = L->intensityAt(P);
-
-            // check if light hits
-            ray shadow_ray(P + N*1e-4, Ldir);
-            double tmax = INFINITY;
-            if (auto* spot = dynamic_cast<spotlight*>(L))
-                tmax = (spot->get_position() - P).length(); // if light is spot light, check intersections up until light source
-            
-            hit_struct shadow_ray_hit = get_min_intersection(shadow_ray, scene, tmax);
-            if (shadow_ray_hit.t > -INFINITY)
-                continue; // object in way, no light (Si = 0)
-            
-            // diffuse
-            double NdotL = std::max(dot(N, Ldir), 0.0);
-            result += baseColor * Li * NdotL;
-
-            // specular
-            vec3 R = -Ldir - 2 * dot(-Ldir, N) * N; // reflected ray direction
-            double RdotV = std::max(dot(R,V), 0.0);
-            result += Ks * std::pow(RdotV, shininess) * Li;
-        }
+                add_light(result, s, Ldir, Li);
+            }
+        });
 
         return result;
     }
 };
 
 #endif
-
-
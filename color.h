@@ -17,7 +17,7 @@ inline color clamp(const color& c, double min, double max) {
     );
 }
 
-void write_color(std::vector<unsigned char>& out, int index, const color& pixel_color){
+inline void write_color(std::vector<unsigned char>& out, int index, const color& pixel_color){
     color clamped_color = clamp(pixel_color, 0.0, 1.0);
     auto r = clamped_color.x();
     auto g = clamped_color.y();
@@ -3,6 +3,7 @@
 
 #include "vec3.h"
 #include "color.h"
+#include "specular.h"
 
 struct light_t {
     vec3 direction;
@@ -20,6 +21,7 @@ struct material_t {
     color ambient;
     color diffuse;
     float shininess;
+    specular_power specular; // evaluates x^shininess, set with the material (primitive::set_material)
 };
 
 #endif
\ No newline at end of file
@@ -21,6 +21,8 @@ public:
         // no attenuation
         return radiance;
     }
+
+    const color& get_radiance() const { return radiance; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <cstddef>
+#include <vector>
+
+// Linear RGB image as the renderer produces it, three floats per pixel in
+// row-major order, before exposure, tone curve and quantization. Only floats
+// and ints, so its layout is the same in every build, see hw2core.h.
+class framebuffer {
+public:
+    framebuffer(int width, int height) : w(width), h(height), rgb(size_t(width) * height * 3, 0.0f) {}
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    /// red, green and blue of pixel (i, j)
+    float* pixel(int i, int j) { return &rgb[(size_t(j) * w + i) * 3]; }
+    const float* pixel(int i, int j) const { return &rgb[(size_t(j) * w + i) * 3]; }
+
+    const float* data() const { return rgb.data(); }
+    float* data() { return rgb.data(); }
+
+private:
+    int w;
+    int h;
+    std::vector<float> rgb;
+};
+
+#endif
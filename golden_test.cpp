@@ -0,0 +1,222 @@
+// Golden image regression test. Renders every bundled scene with a fixed
+// jitter seed and compares the image against its reference in golden/:
+// a scene fails when too many pixels differ by more than PIXEL_TOLERANCE in
+// some channel, or when PSNR or mean SSIM fall below their limits, so small
+// rounding changes (float path, SIMD, another traversal order) pass while
+// visible ones do not. The render and a diff image of every failing scene are
+// kept in the output directory. --update rewrites the references instead.
+//
+// Usage: hw2_golden_test [--scenes dir] [--golden dir] [--out dir]
+//                        [--accel auto|bvh2|bvh4|bvh8|bvh4c|grid] [--wavefront]
+//                        [--update] [scene names]
+
+#include "hw2core.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef HW2_SOURCE_DIR
+#define HW2_SOURCE_DIR "."
+#endif
+
+#define GOLDEN_RESOLUTION 256
+#define GOLDEN_SEED 1
+#define PIXEL_TOLERANCE 8     // largest channel difference of a pixel that counts as equal
+#define MAX_BAD_PIXELS 0.005  // share of pixels allowed above it, silhouettes and the horizon move in float
+#define MIN_PSNR 40.0         // dB over all channels
+#define MIN_SSIM 0.98         // mean over windows of luma
+#define SSIM_WINDOW 8
+#define SSIM_STEP 4
+
+namespace fs = std::filesystem;
+
+struct rgb_image {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels; // RGB rows, top to bottom
+};
+
+struct image_metrics {
+    int max_diff = 0;         // largest channel difference
+    double bad_fraction = 0;  // pixels with a channel differing by more than PIXEL_TOLERANCE
+    double psnr = INFINITY;
+    double ssim = 1.0;
+};
+
+// empty image if the file is missing or not an image
+static rgb_image load_png(const fs::path& path) {
+    rgb_image image;
+    int channels = 0;
+    unsigned char* data = stbi_load(path.string().c_str(), &image.width, &image.height, &channels, 3);
+    if (!data) return rgb_image();
+    image.pixels.assign(data, data + size_t(image.width) * image.height * 3);
+    stbi_image_free(data);
+    return image;
+}
+
+static std::vector<double> luma(const rgb_image& image) {
+    std::vector<double> y(size_t(image.width) * image.height);
+    for (size_t k = 0; k < y.size(); k++) {
+        const unsigned char* p = &image.pixels[k * 3];
+        y[k] = 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+    }
+    return y;
+}
+
+// mean SSIM of the luma over SSIM_WINDOW square windows every SSIM_STEP pixels
+static double mean_ssim(const rgb_image& a, const rgb_image& b) {
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    const double n = SSIM_WINDOW * SSIM_WINDOW;
+    std::vector<double> ya = luma(a), yb = luma(b);
+    double sum = 0;
+    int windows = 0;
+    for (int y0 = 0; y0 + SSIM_WINDOW <= a.height; y0 += SSIM_STEP) {
+        for (int x0 = 0; x0 + SSIM_WINDOW <= a.width; x0 += SSIM_STEP) {
+            double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+            for (int j = y0; j < y0 + SSIM_WINDOW; j++) {
+                for (int i = x0; i < x0 + SSIM_WINDOW; i++) {
+                    double va = ya[size_t(j) * a.width + i], vb = yb[size_t(j) * a.width + i];
+                    sa += va;
+                    sb += vb;
+                    saa += va * va;
+                    sbb += vb * vb;
+                    sab += va * vb;
+                }
+            }
+            double ma = sa / n, mb = sb / n;
+            double var_a = saa / n - ma * ma, var_b = sbb / n - mb * mb, cov = sab / n - ma * mb;
+            sum += ((2 * ma * mb + c1) * (2 * cov + c2)) / ((ma * ma + mb * mb + c1) * (var_a + var_b + c2));
+            windows++;
+        }
+    }
+    return windows ? sum / windows : 1.0;
+}
+
+static image_metrics compare(const rgb_image& actual, const rgb_image& expected) {
+    image_metrics m;
+    size_t pixels = size_t(actual.width) * actual.height;
+    size_t bad = 0;
+    double squared = 0;
+    for (size_t k = 0; k < pixels; k++) {
+        int worst = 0;
+        for (int c = 0; c < 3; c++) {
+            int d = std::abs(int(actual.pixels[k * 3 + c]) - int(expected.pixels[k * 3 + c]));
+            worst = std::max(worst, d);
+            squared += double(d) * d;
+        }
+        if (worst > PIXEL_TOLERANCE) bad++;
+        m.max_diff = std::max(m.max_diff, worst);
+    }
+    m.bad_fraction = pixels ? double(bad) / double(pixels) : 0.0;
+    if (squared > 0) m.psnr = 10.0 * std::log10(255.0 * 255.0 / (squared / double(pixels * 3)));
+    m.ssim = mean_ssim(actual, expected);
+    return m;
+}
+
+static bool passes(const image_metrics& m) {
+    return m.bad_fraction <= MAX_BAD_PIXELS && m.psnr >= MIN_PSNR && m.ssim >= MIN_SSIM;
+}
+
+// the reference dimmed to grey, pixels beyond the tolerance in red brightening
+// with the difference, smaller differences in blue
+static void write_diff(const rgb_image& actual, const rgb_image& expected, const fs::path& path) {
+    std::vector<unsigned char> diff(actual.pixels.size());
+    for (size_t k = 0; k < diff.size() / 3; k++) {
+        const unsigned char* a = &actual.pixels[k * 3];
+        const unsigned char* e = &expected.pixels[k * 3];
+        int worst = 0;
+        for (int c = 0; c < 3; c++) worst = std::max(worst, std::abs(int(a[c]) - int(e[c])));
+        unsigned char grey = (unsigned char)((0.299 * e[0] + 0.587 * e[1] + 0.114 * e[2]) * 0.25);
+        unsigned char* p = &diff[k * 3];
+        p[0] = p[1] = p[2] = grey;
+        if (worst > PIXEL_TOLERANCE) p[0] = (unsigned char)std::min(255, 128 + worst);
+        else if (worst > 0) p[2] = (unsigned char)std::min(255, 64 + worst * 16);
+    }
+    write_png_rgb(path.string(), actual.width, actual.height, diff.data());
+}
+
+// renders scene_file as hw2 would with --seed GOLDEN_SEED
+static void render_scene(const fs::path& scene_file, const std::string& accel_name, bool wavefront,
+                         const fs::path& output) {
+    renderer r;
+    r.load(scene_file.string());
+    render_options options;
+    options.width = options.height = GOLDEN_RESOLUTION;
+    options.accel = accel_name;
+    options.wavefront = wavefront;
+    options.seed = GOLDEN_SEED;
+    write_png(r.render(options), output.string());
+}
+
+int main(int argc, char* argv[]) {
+    fs::path scenes = HW2_SOURCE_DIR;
+    fs::path golden = fs::path(HW2_SOURCE_DIR) / "golden";
+    fs::path out = "golden_out";
+    std::string accel_name = "auto";
+    bool wavefront = false;
+    bool update = false;
+    std::vector<std::string> names;
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--scenes" && a + 1 < argc) scenes = argv[++a];
+        else if (arg == "--golden" && a + 1 < argc) golden = argv[++a];
+        else if (arg == "--out" && a + 1 < argc) out = argv[++a];
+        else if (arg == "--accel" && a + 1 < argc) accel_name = argv[++a];
+        else if (arg == "--wavefront") wavefront = true;
+        else if (arg == "--update") update = true;
+        else names.push_back(arg);
+    }
+    if (names.empty())
+        names = {"scene1", "scene2", "scene3", "scene4", "scene5",
+                 "our_scene1", "our_scene2", "our_scene2aa", "our_scene3"};
+
+    fs::create_directories(update ? golden : out);
+    int failures = 0;
+    for (const std::string& name : names) {
+        fs::path render_path = (update ? golden : out) / (name + ".png");
+        render_scene(scenes / (name + ".txt"), accel_name, wavefront, render_path);
+        if (update) {
+            std::printf("%-14s reference written\n", name.c_str());
+            continue;
+        }
+
+        rgb_image actual = load_png(render_path);
+        rgb_image expected = load_png(golden / (name + ".png"));
+        if (expected.width == 0) {
+            std::printf("%-14s FAIL  no reference, run with --update\n", name.c_str());
+            failures++;
+            continue;
+        }
+        if (actual.width != expected.width || actual.height != expected.height) {
+            std::printf("%-14s FAIL  %dx%d, reference is %dx%d\n", name.c_str(), actual.width, actual.height,
+                        expected.width, expected.height);
+            failures++;
+            continue;
+        }
+
+        image_metrics m = compare(actual, expected);
+        bool ok = passes(m);
+        std::printf("%-14s %s  max diff %3d  bad pixels %7.4f%%  PSNR %6.2f dB  SSIM %.5f\n", name.c_str(),
+                    ok ? "ok  " : "FAIL", m.max_diff, m.bad_fraction * 100.0, m.psnr, m.ssim);
+        if (ok) {
+            fs::remove(render_path);
+        } else {
+            fs::path diff_path = out / (name + ".diff.png");
+            write_diff(actual, expected, diff_path);
+            std::printf("%-14s render %s, diff %s\n", "", render_path.string().c_str(), diff_path.string().c_str());
+            failures++;
+        }
+    }
+
+    if (failures) std::printf("%d of %zu scenes differ from their reference\n", failures, names.size());
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "aabb.h"
+#include "accelerator.h"
+#include "parallel.h"
+#include "primitive.h"
+#include "radix_sort.h"
+
+#define GRID_DENSITY 3          // target cells per primitive
+#define GRID_MAX_RES 512        // cells per axis
+#define GRID_AUTO_MIN_PRIMS 4096
+#define GRID_AUTO_MAX_SIZE_RATIO 2.0
+#define GRID_AUTO_MIN_OCCUPANCY 0.4
+
+// cells per axis for n primitives inside bounds, about density * n cells in total
+// but never cells smaller than min_cell, so large primitives do not land in dozens of cells
+inline void grid_resolution(const aabb& bounds, size_t n, double density, int res[3], double min_cell = 0.0) {
+    vec3 ext = bounds.extent();
+    real largest = std::max(ext.x(), std::max(ext.y(), ext.z()));
+    // flat scenes still get a slab of cells along the thin axis
+    real thin = real(1e-3) * largest;
+    vec3 e(std::max(ext.x(), thin), std::max(ext.y(), thin), std::max(ext.z(), thin));
+    double per_unit = std::cbrt(density * double(n) / (e.x() * e.y() * e.z()));
+    if (min_cell > 0) per_unit = std::min(per_unit, 1.0 / min_cell);
+    for (int a = 0; a < 3; a++)
+        res[a] = int(clamp(std::floor(e[a] * per_unit), 1.0, double(GRID_MAX_RES)));
+}
+
+// Uniform grid over the bounded primitives, built with a parallel counting sort
+// of (cell, primitive) references and traversed with a 3D-DDA
+// (Amanatides and Woo). Suits dense, evenly spread primitives of similar size,
+// where it builds faster than a hierarchy and needs no stack.
+class uniform_grid : public accelerator {
+public:
+    explicit uniform_grid(const std::vector<primitive*>& scene) { build(scene); }
+
+    bool closest_hit(const ray& r, real tmin, real tmax, hit_struct& hit_out) const override {
+        bool hit_any = false;
+        hit_struct tmp;
+        for (auto* obj : unbounded) {
+            if (obj->hit(r, tmin, tmax, tmp)) {
+                hit_out = tmp;
+                tmax = tmp.t;
+                hit_any = true;
+            }
+        }
+        if (prims.empty()) return hit_any;
+
+        walker w;
+        if (!start(r, tmin, tmax, w)) return hit_any;
+        while (true) {
+            uint32_t c = cell_index(w.cell);
+            COUNT_NODE_VISIT();
+            for (uint32_t k = cell_start[c]; k < cell_start[c + 1]; k++) {
+                if (prims[refs[k]]->hit(r, tmin, tmax, tmp)) {
+                    hit_out = tmp;
+                    tmax = tmp.t;
+                    hit_any = true;
+                }
+            }
+            // a hit inside this cell cannot be beaten by a later cell
+            if (!step(w) || w.t_enter > tmax) break;
+        }
+        return hit_any;
+    }
+
+    bool occluded(const ray& r, real tmin, real tmax) const override {
+        for (auto* obj : unbounded)
+            if (obj->any_hit(r, tmin, tmax)) return true;
+        if (prims.empty()) return false;
+
+        walker w;
+        if (!start(r, tmin, tmax, w)) return false;
+        while (true) {
+            uint32_t c = cell_index(w.cell);
+            COUNT_NODE_VISIT();
+            for (uint32_t k = cell_start[c]; k < cell_start[c + 1]; k++)
+                if (prims[refs[k]]->any_hit(r, tmin, tmax)) return true;
+            if (!step(w) || w.t_enter > tmax) break;
+        }
+        return false;
+    }
+
+    size_t memory_bytes() const override {
+        return cell_start.size() * sizeof(uint32_t) + refs.size() * sizeof(uint32_t)
+             + (prims.size() + unbounded.size()) * sizeof(primitive*);
+    }
+
+    const int* get_resolution() const { return res; }
+
+private:
+    std::vector<primitive*> prims;
+    std::vector<primitive*> unbounded;
+    std::vector<uint32_t> cell_start; // refs of cell c are refs[cell_start[c] .. cell_start[c + 1])
+    std::vector<uint32_t> refs;       // indices into prims
+    aabb bounds;
+    int res[3] = {1, 1, 1};
+    vec3 cell_size;
+    vec3 inv_cell_size;
+
+    // DDA state of one ray
+    struct walker {
+        int cell[3];
+        int step[3];
+        real t_next[3];  // distance to the next cell boundary per axis
+        real t_delta[3]; // distance between boundaries per axis
+        real t_enter;    // distance where the current cell was entered
+    };
+
+    uint32_t cell_index(const int cell[3]) const {
+        return uint32_t((cell[2] * res[1] + cell[1]) * res[0] + cell[0]);
+    }
+
+    int cell_of(real v, int axis) const {
+        int c = int(std::floor((v - bounds.lo[axis]) * inv_cell_size[axis]));
+        return std::min(std::max(c, 0), res[axis] - 1);
+    }
+
+    bool start(const ray& r, real tmin, real tmax, walker& w) const {
+        vec3 inv_dir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z());
+        real t_entry;
+        if (!bounds.hit(r.origin(), inv_dir, tmin, tmax, t_entry)) return false;
+
+        point3 p = r.at(t_entry);
+        w.t_enter = t_entry;
+        for (int a = 0; a < 3; a++) {
+            w.cell[a] = cell_of(p[a], a);
+            real d = r.direction()[a];
+            if (d > 0) {
+                w.step[a] = 1;
+                w.t_next[a] = (bounds.lo[a] + (w.cell[a] + 1) * cell_size[a] - r.origin()[a]) * inv_dir[a];
+                w.t_delta[a] = cell_size[a] * inv_dir[a];
+            } else if (d < 0) {
+                w.step[a] = -1;
+                w.t_next[a] = (bounds.lo[a] + w.cell[a] * cell_size[a] - r.origin()[a]) * inv_dir[a];
+                w.t_delta[a] = -cell_size[a] * inv_dir[a];
+            } else {
+                w.step[a] = 0;
+                w.t_next[a] = INFINITY;
+                w.t_delta[a] = INFINITY;
+            }
+        }
+        return true;
+    }
+
+    // moves to the next cell along the ray, false once the ray leaves the grid
+    bool step(walker& w) const {
+        int a = w.t_next[0] < w.t_next[1] ? (w.t_next[0] < w.t_next[2] ? 0 : 2)
+                                          : (w.t_next[1] < w.t_next[2] ? 1 : 2);
+        w.t_enter = w.t_next[a];
+        w.cell[a] += w.step[a];
+        if (w.cell[a] < 0 || w.cell[a] >= res[a]) return false;
+        w.t_next[a] += w.t_delta[a];
+        return true;
+    }
+
+    void build(const std::vector<primitive*>& scene) {
+        std::vector<aabb> all_boxes(scene.size());
+        std::vector<char> has_box(scene.size());
+        parallel_for(scene.size(), [&](size_t i) {
+            has_box[i] = scene[i]->bounding_box(all_boxes[i]);
+        });
+
+        std::vector<aabb> boxes;
+        double extent_sum = 0;
+        for (size_t i = 0; i < scene.size(); i++) {
+            if (has_box[i]) {
+                prims.push_back(scene[i]);
+                boxes.push_back(all_boxes[i]);
+                bounds.grow(all_boxes[i]);
+                vec3 e = all_boxes[i].extent();
+                extent_sum += (e.x() + e.y() + e.z()) / 3.0;
+            } else {
+                unbounded.push_back(scene[i]);
+            }
+        }
+        if (prims.empty()) return;
+
+        if (prims.size() > UINT32_MAX) throw std::runtime_error("Too many objects for a uniform grid");
+        grid_resolution(bounds, prims.size(), GRID_DENSITY, res, extent_sum / double(prims.size()));
+        vec3 ext = bounds.extent();
+        for (int a = 0; a < 3; a++)
+            if (ext[a] <= 0) res[a] = 1;
+
+        // counting sort of (cell, primitive) pairs: count the cells each primitive
+        // overlaps, scan to get its output range, emit the pairs and radix sort them by cell.
+        // Pairs are indexed with 32 bits, while there are more the grid is halved per axis;
+        // one cell per axis has exactly one pair per primitive.
+        std::vector<uint32_t> first_pair(prims.size() + 1);
+        size_t pairs;
+        for (;;) {
+            set_cell_size(ext);
+            parallel_for(prims.size(), [&](size_t i) {
+                int lo[3], hi[3];
+                cell_range(boxes[i], lo, hi);
+                // at most GRID_MAX_RES^3 cells
+                first_pair[i] = uint32_t((hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1));
+            });
+            pairs = 0;
+            for (size_t i = 0; i < prims.size(); i++) pairs += first_pair[i];
+            if (pairs <= UINT32_MAX) break;
+            for (int a = 0; a < 3; a++) res[a] = std::max(1, res[a] / 2);
+        }
+        size_t cells = size_t(res[0]) * res[1] * res[2];
+        for (size_t i = 0, sum = 0; i < prims.size(); i++) {
+            uint32_t count = first_pair[i];
+            first_pair[i] = uint32_t(sum);
+            sum += count;
+        }
+        first_pair[prims.size()] = uint32_t(pairs);
+
+        std::vector<uint32_t> keys(pairs);
+        refs.resize(pairs);
+        parallel_for(prims.size(), [&](size_t i) {
+            int lo[3], hi[3];
+            cell_range(boxes[i], lo, hi);
+            uint32_t k = first_pair[i];
+            for (int z = lo[2]; z <= hi[2]; z++)
+                for (int y = lo[1]; y <= hi[1]; y++)
+                    for (int x = lo[0]; x <= hi[0]; x++) {
+                        int cell[3] = {x, y, z};
+                        keys[k] = cell_index(cell);
+                        refs[k++] = uint32_t(i);
+                    }
+        });
+
+        unsigned key_bits = 1;
+        while (key_bits < 32 && (size_t(1) << key_bits) < cells) key_bits++;
+        radix_sort_pairs(keys, refs, key_bits);
+
+        // stable sort, so each cell lists its primitives in scene order
+        cell_start.assign(cells + 1, 0);
+        for (size_t k = 0; k < pairs; k++) cell_start[keys[k] + 1]++;
+        for (size_t c = 0; c < cells; c++) cell_start[c + 1] += cell_start[c];
+    }
+
+    void set_cell_size(const vec3& ext) {
+        cell_size = vec3(ext.x() / res[0], ext.y() / res[1], ext.z() / res[2]);
+        inv_cell_size = vec3(cell_size.x() > 0 ? 1.0 / cell_size.x() : 0.0,
+                             cell_size.y() > 0 ? 1.0 / cell_size.y() : 0.0,
+                             cell_size.z() > 0 ? 1.0 / cell_size.z() : 0.0);
+    }
+
+    void cell_range(const aabb& box, int lo[3], int hi[3]) const {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = cell_of(box.lo[a], a);
+            hi[a] = cell_of(box.hi[a], a);
+        }
+    }
+};
+
+// Scene statistics heuristic for --accel auto: a grid pays off when there are
+// many bounded primitives of about the same size spread evenly over their
+// bounds, i.e. most cells of a grid with one cell per primitive are occupied.
+inline bool grid_suits_scene(const std::vector<primitive*>& scene) {
+    std::vector<point3> centers;
+    aabb bounds;
+    double smallest = INFINITY, largest = 0;
+    for (auto* obj : scene) {
+        aabb box;
+        if (!obj->bounding_box(box)) continue;
+        double size = box.extent().length();
+        smallest = std::min(smallest, size);
+        largest = std::max(largest, size);
+        centers.push_back(box.centroid());
+        bounds.grow(box.centroid());
+    }
+    if (centers.size() < GRID_AUTO_MIN_PRIMS) return false;
+    if (largest > GRID_AUTO_MAX_SIZE_RATIO * smallest) return false;
+
+    int res[3];
+    grid_resolution(bounds, centers.size(), 1.0, res);
+    vec3 ext = bounds.extent();
+    std::vector<char> occupied(size_t(res[0]) * res[1] * res[2], 0);
+    for (const auto& p : centers) {
+        int cell[3];
+        for (int a = 0; a < 3; a++) {
+            double rel = ext[a] > 0 ? (p[a] - bounds.lo[a]) / ext[a] : 0.0;
+            cell[a] = std::min(int(rel * res[a]), res[a] - 1);
+        }
+        occupied[(size_t(cell[2]) * res[1] + cell[1]) * res[0] + cell[0]] = 1;
+    }
+    size_t used = size_t(std::count(occupied.begin(), occupied.end(), 1));
+    // uniformly random centers fill about 1 - 1/e of the cells
+    return double(used) >= GRID_AUTO_MIN_OCCUPANCY * double(occupied.size());
+}
+
+#endif
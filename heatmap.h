@@ -0,0 +1,67 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Render cost per block of pixels (a tile, or a single pixel), in nanoseconds,
+// shown as a false-colour image of the same size as the render.
+class cost_heatmap {
+public:
+    /// @param cell  edge of a block in pixels
+    cost_heatmap(int width, int height, int cell)
+        : width(width), height(height), cell(cell),
+          cells_x((width + cell - 1) / cell), cells_y((height + cell - 1) / cell),
+          cost(size_t(cells_x) * cells_y, 0) {}
+
+    int get_cell() const { return cell; }
+
+    /// adds to the block holding pixel (i, j), blocks are only ever added to by one thread
+    void add(int i, int j, uint64_t ns) { cost[size_t(j / cell) * cells_x + i / cell] += ns; }
+
+    /// cost shown as red, the 99th percentile so a few blocks hit by preemption
+    /// or page faults do not turn everything else blue
+    uint64_t red_cost() const {
+        if (cost.empty()) return 0;
+        std::vector<uint64_t> sorted = cost;
+        auto p99 = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+        std::nth_element(sorted.begin(), p99, sorted.end());
+        return *p99;
+    }
+
+    /// RGB image, blue for cheap through green and yellow to red for red_cost and above
+    std::vector<unsigned char> to_image() const {
+        uint64_t red = red_cost();
+        double scale = red > 0 ? 1.0 / double(red) : 0.0;
+        std::vector<unsigned char> image(size_t(width) * height * 3);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                double v = double(cost[size_t(j / cell) * cells_x + i / cell]) * scale;
+                unsigned char* p = &image[(size_t(j) * width + i) * 3];
+                false_color(v, p);
+            }
+        }
+        return image;
+    }
+
+private:
+    int width;
+    int height;
+    int cell;
+    int cells_x;
+    int cells_y;
+    std::vector<uint64_t> cost;
+
+    // piecewise linear through blue, cyan, green, yellow and red, v in [0, 1]
+    static void false_color(double v, unsigned char* rgb) {
+        static const double stops[5][3] = {{0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}};
+        double x = std::min(std::max(v, 0.0), 1.0) * 4.0;
+        int k = std::min(int(x), 3);
+        double f = x - k;
+        for (int c = 0; c < 3; c++)
+            rgb[c] = (unsigned char)(255.999 * (stops[k][c] + f * (stops[k + 1][c] - stops[k][c])));
+    }
+};
+
+#endif
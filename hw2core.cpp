@@ -0,0 +1,211 @@
+#include "hw2core.h"
+
+#include "accel_factory.h"
+#include "camera.h"
+#include "directional_light.h"
+#include "parser.h"
+#include "plane.h"
+#include "scene_data.h"
+#include "sphere.h"
+#include "spotlight.h"
+#include "render_stats.h"
+
+#include <chrono>
+#include <future>
+#include <stdexcept>
+
+struct renderer::state {
+    scene_data world;
+    point3 eye;
+    int aa_samples = 1;
+    bool has_camera = false;
+    color ambient = color(0, 0, 0);
+    std::shared_ptr<const accelerator> accel; // null until a render, and again once objects change
+    std::string accel_name;
+};
+
+static vec3 to_vec3(const vec3d& v) { return vec3(real(v.x), real(v.y), real(v.z)); }
+static color to_color(const rgb_color& c) { return color(real(c.r), real(c.g), real(c.b)); }
+
+static material_t to_material(const surface_material& m) {
+    material_t material;
+    material.ambient = to_color(m.ambient);
+    material.diffuse = to_color(m.diffuse);
+    material.shininess = float(m.shininess);
+    return material;
+}
+
+struct render_job::state {
+    state(const camera& cam, const light_table& lights, int width, int height)
+        : cam(cam), lights(lights), tiles(width, height) {}
+
+    std::shared_ptr<const void> scene; // the renderer's objects and lights
+    std::shared_ptr<const accelerator> accel; // shared with the renderer until its objects change
+    camera cam;
+    light_table lights;
+    color ambient;
+    int aa_samples = 1;
+    bool wavefront = false;
+    tile_render tiles;
+    std::shared_future<bool> finished; // true when every tile was rendered
+};
+
+render_job::render_job(std::shared_ptr<state> impl) : impl(std::move(impl)) {}
+render_job::render_job(render_job&&) noexcept = default;
+
+render_job& render_job::operator=(render_job&& other) noexcept {
+    if (this != &other) {
+        if (impl) {
+            cancel();
+            wait();
+        }
+        impl = std::move(other.impl);
+    }
+    return *this;
+}
+
+render_job::~render_job() {
+    if (!impl) return;
+    cancel();
+    wait();
+}
+
+void render_job::cancel() {
+    if (impl) impl->tiles.cancel();
+}
+
+bool render_job::is_done() const {
+    return !impl || impl->finished.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void render_job::wait() const {
+    if (impl) impl->finished.wait();
+}
+
+bool render_job::was_cancelled() const {
+    if (!impl) return false;
+    wait();
+    return impl->tiles.is_cancelled() && impl->tiles.tiles_done() < impl->tiles.tiles_total();
+}
+
+size_t render_job::tiles_done() const { return impl ? impl->tiles.tiles_done() : 0; }
+size_t render_job::tiles_total() const { return impl ? impl->tiles.tiles_total() : 0; }
+
+framebuffer render_job::snapshot() const {
+    if (!impl) throw std::logic_error("render_job::snapshot on a job that was moved from");
+    return impl->tiles.snapshot();
+}
+
+framebuffer render_job::get() {
+    if (!impl) throw std::logic_error("render_job::get on a job that was moved from");
+    impl->finished.get();
+    return impl->tiles.take_image();
+}
+
+renderer::renderer() : impl(std::make_shared<state>()) {}
+renderer::~renderer() = default;
+renderer::renderer(renderer&&) noexcept = default;
+renderer& renderer::operator=(renderer&&) noexcept = default;
+
+void renderer::load(const std::string& scene_file) {
+    scoped_phase timer("parse");
+    parser scene_parser;
+    scene_parser.load(scene_file);
+    scene_parser.get_scene_objects(impl->world);
+    scene_parser.get_lights(impl->world);
+    impl->eye = scene_parser.get_eye();
+    impl->aa_samples = scene_parser.get_aa_samples();
+    impl->has_camera = true;
+    impl->ambient = scene_parser.get_ambient();
+    impl->accel.reset();
+}
+
+void renderer::set_camera(const vec3d& eye, int aa_samples) {
+    impl->eye = to_vec3(eye);
+    impl->aa_samples = std::max(1, aa_samples);
+    impl->has_camera = true;
+}
+
+void renderer::set_ambient(const rgb_color& ambient) { impl->ambient = to_color(ambient); }
+
+void renderer::add_sphere(const vec3d& center, double radius, const surface_material& material) {
+    primitive* obj = impl->world.create<sphere>(to_vec3(center), real(radius));
+    obj->set_material(to_material(material));
+    impl->world.add_object(obj);
+    impl->accel.reset();
+}
+
+void renderer::add_plane(const vec3d& normal, double d, const surface_material& material) {
+    primitive* obj = impl->world.create<plane>(normal.x, normal.y, normal.z, d);
+    obj->set_material(to_material(material));
+    impl->world.add_object(obj);
+    impl->accel.reset();
+}
+
+void renderer::add_directional_light(const vec3d& direction, const rgb_color& intensity) {
+    impl->world.add_light(impl->world.create<directional_light>(to_vec3(direction), to_color(intensity)));
+}
+
+void renderer::add_spotlight(const vec3d& position, const vec3d& direction, double cos_cutoff, const rgb_color& intensity) {
+    impl->world.add_light(impl->world.create<spotlight>(to_vec3(position), to_vec3(direction), real(cos_cutoff),
+                                                        to_color(intensity)));
+}
+
+size_t renderer::object_count() const { return impl->world.get_objects().size(); }
+size_t renderer::light_count() const { return impl->world.get_lights().size(); }
+
+void renderer::prepare(const render_options& options) {
+    if (!impl->has_camera) throw std::runtime_error("No camera set, call set_camera or load a scene first");
+    if (impl->accel && impl->accel_name == options.accel) return;
+    scoped_phase timer("build");
+    const auto& scene = impl->world.get_objects();
+    std::string kind = resolve_accelerator(options.accel, scene);
+    // saved next to the scene file, e.g. scene1.bvh8.cache
+    if (!options.cache_prefix.empty() && scene.size() >= options.cache_min_objects)
+        impl->accel = make_cached_accelerator(kind, scene, options.cache_prefix + "." + kind + ".cache", options.log);
+    else
+        impl->accel = make_accelerator(kind, scene);
+    impl->accel_name = options.accel;
+}
+
+// the camera render and render_async look through
+static camera make_camera(const point3& eye, const render_options& options) {
+    camera cam(eye, options.height, options.width, color(0, 0, 0)); // black bg
+    cam.set_shadow_ray_sorting(options.shadow_ray_sorting);
+    if (options.seed >= 0) cam.set_seed(uint32_t(options.seed));
+    if (!options.heatmap_path.empty()) cam.set_cost_heatmap(options.heatmap_path, options.heatmap_pixels);
+    cam.set_log(options.log);
+    return cam;
+}
+
+framebuffer renderer::render(const render_options& options,
+                             const std::function<void(size_t done, size_t total)>& progress) {
+    prepare(options);
+    camera cam = make_camera(impl->eye, options);
+    const auto& lights = impl->world.get_lights();
+    if (options.wavefront)
+        return cam.render_wavefront_image(*impl->accel, lights, impl->ambient, impl->aa_samples, progress);
+    return cam.render_image(*impl->accel, lights, impl->ambient, impl->aa_samples, progress);
+}
+
+render_job renderer::render_async(const render_options& options,
+                                  std::function<void(size_t done, size_t total)> progress) {
+    prepare(options);
+    // everything the job reads is copied or shared here, on the calling thread
+    auto job = std::make_shared<render_job::state>(make_camera(impl->eye, options),
+                                                   light_table(impl->world.get_lights()),
+                                                   options.width, options.height);
+    job->scene = impl;
+    job->accel = impl->accel;
+    job->ambient = impl->ambient;
+    job->aa_samples = impl->aa_samples;
+    job->wavefront = options.wavefront;
+    job->tiles.progress = std::move(progress);
+
+    // the handle waits for the thread before the state goes away
+    render_job::state* s = job.get();
+    job->finished = std::async(std::launch::async, [s] {
+        return s->cam.render_tiles(*s->accel, s->lights, s->ambient, s->aa_samples, s->wavefront, s->tiles);
+    }).share();
+    return render_job(std::move(job));
+}
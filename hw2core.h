@@ -0,0 +1,156 @@
+#ifndef HW2CORE_H
+#define HW2CORE_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "framebuffer.h"
+#include "image_write.h"
+#include "postprocess.h"
+
+// Everything passed through this API has the same layout in every build of the
+// library: geometry goes in as plain doubles, whatever HW2_SINGLE_PRECISION and
+// the SIMD width of the internal vectors, and framebuffer and post_settings
+// hold only floats, ints and flags. None of the headers included here use the
+// internal vec3 or color types, so a program that includes only this header
+// can use a library built with other options than its own. Programs that also
+// include the internal headers (camera.h and the like) must be built with the
+// library's options, which CMake passes on to them.
+
+// a point, direction or plane coefficients
+struct vec3d {
+    double x = 0, y = 0, z = 0;
+};
+
+// linear RGB, 1 is full intensity
+struct rgb_color {
+    double r = 0, g = 0, b = 0;
+};
+
+struct surface_material {
+    rgb_color ambient;  // scaled by the scene's ambient light
+    rgb_color diffuse;  // also the color of the specular highlight
+    double shininess = 1;
+};
+
+// how renderer::render traces the image
+struct render_options {
+    int width = 384;  // the view spans the same square whatever the size, so
+    int height = 384; // images that are not square are stretched
+    std::string accel = "auto";     // auto, bvh2, bvh4, bvh8, bvh4c or grid
+    bool wavefront = false;         // the wavefront renderer instead of the scanline one
+    bool shadow_ray_sorting = true; // wavefront only
+    long long seed = -1;            // anti-aliasing jitter, -1 takes it from the clock
+
+    // a bvh4, bvh8 or bvh4c is reused from <cache_prefix>.<structure>.cache when
+    // it was saved there for the same objects, and saved there otherwise
+    std::string cache_prefix;        // empty: never cached
+    size_t cache_min_objects = 10000; // smaller scenes build faster than a cache is hashed
+
+    // time spent per tile, or per pixel with heatmap_pixels, as a false-colour PNG
+    std::string heatmap_path; // empty: none
+    bool heatmap_pixels = false; // scanline renderer only
+
+    // one line of news without a newline, such as a cache that was loaded or
+    // the heatmap scale; the library writes nothing to the console itself
+    std::function<void(const std::string& line)> log; // empty: dropped
+};
+
+// A render running on a thread of its own, started by renderer::render_async.
+// It renders a tile at a time: progress is counted in tiles, cancel takes
+// effect before the next tile and snapshot copies out the finished tiles.
+// The handle owns the render, destroying it cancels the render and waits.
+// A handle moved from is empty: cancel and wait do nothing, it is done and
+// not cancelled with no tiles, and snapshot and get throw std::logic_error.
+class render_job {
+public:
+    render_job(render_job&&) noexcept;
+    render_job& operator=(render_job&&) noexcept;
+    render_job(const render_job&) = delete;
+    render_job& operator=(const render_job&) = delete;
+    ~render_job();
+
+    /// asks the render to stop, the tiles in progress are still finished
+    void cancel();
+    /// finished, cancelled or failed, never blocks
+    bool is_done() const;
+    void wait() const;
+    /// true once done if it stopped before every tile was rendered
+    bool was_cancelled() const;
+
+    size_t tiles_done() const;
+    size_t tiles_total() const;
+    /// copy of the image so far, tiles not yet finished are black
+    /// @throws std::logic_error after get
+    framebuffer snapshot() const;
+    /// waits and moves the image out, the finished tiles only when cancelled;
+    /// the image can be taken once
+    /// @throws what the render threw, std::logic_error when called again
+    framebuffer get();
+
+private:
+    friend class renderer;
+    struct state;
+    explicit render_job(std::shared_ptr<state> impl);
+    std::shared_ptr<state> impl;
+};
+
+// The renderer as a library. A scene is built object by object or loaded from
+// a scene file and rendered in process into a framebuffer, so nothing is
+// written to disk unless asked for with write_png. The acceleration structure
+// is built by the first render and reused by later ones until objects are
+// added or another structure is asked for.
+class renderer {
+public:
+    renderer();
+    ~renderer();
+    renderer(renderer&&) noexcept;
+    renderer& operator=(renderer&&) noexcept;
+    renderer(const renderer&) = delete;
+    renderer& operator=(const renderer&) = delete;
+
+    /// adds the objects and lights of a scene file and takes its camera and ambient light
+    /// @throws std::runtime_error when the file cannot be read or is incomplete
+    void load(const std::string& scene_file);
+
+    /// eye position, the camera always looks at the center of the z = 0 plane
+    void set_camera(const vec3d& eye, int aa_samples = 1);
+    void set_ambient(const rgb_color& ambient);
+
+    void add_sphere(const vec3d& center, double radius, const surface_material& material);
+    /// the plane ax + by + cz + d = 0, with (a, b, c) in normal
+    void add_plane(const vec3d& normal, double d, const surface_material& material);
+    /// @param direction  from the light toward the scene
+    void add_directional_light(const vec3d& direction, const rgb_color& intensity);
+    /// @param direction   cone axis, from the light toward the scene
+    /// @param cos_cutoff  cosine of the angle between the axis and the edge of the cone
+    void add_spotlight(const vec3d& position, const vec3d& direction, double cos_cutoff, const rgb_color& intensity);
+
+    size_t object_count() const;
+    size_t light_count() const;
+
+    /// linear colors before exposure and tone curve, see post_pass and write_png
+    /// @param progress  scanlines done and in total, or tiles with options.wavefront,
+    ///                  called on the render threads as each one is finished
+    /// @throws std::runtime_error without a camera or for an unknown acceleration structure
+    framebuffer render(const render_options& options = render_options(),
+                       const std::function<void(size_t done, size_t total)>& progress = nullptr);
+
+    /// starts render on another thread and returns at once; the job keeps what
+    /// it renders alive, so the renderer can be changed or destroyed meanwhile
+    /// @param progress  tiles done and in total, called on the render threads after each tile
+    /// @throws std::runtime_error as render does, before anything is started
+    render_job render_async(const render_options& options = render_options(),
+                            std::function<void(size_t done, size_t total)> progress = nullptr);
+
+private:
+    struct state;
+    std::shared_ptr<state> impl;
+
+    // builds the acceleration structure unless the current one is of that kind
+    void prepare(const render_options& options);
+};
+
+#endif
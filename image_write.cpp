@@ -0,0 +1,31 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "image_write.h"
+#include "render_stats.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+void write_png(const framebuffer& image, const std::string& path, const post_settings& post) {
+    scoped_phase timer("encode");
+    std::vector<unsigned char> pixels;
+    post_pass(post).run(image, pixels);
+    int width = image.width(), height = image.height();
+    int png_size = 0;
+    unsigned char* png = stbi_write_png_to_mem(pixels.data(), width * 3, width, height, 3, &png_size);
+    timer.stop();
+
+    trace_span span("write");
+    std::ofstream out(path, std::ios::binary);
+    if (png) out.write(reinterpret_cast<const char*>(png), png_size);
+    free(png);
+    if (!png || !out) throw std::runtime_error("Failed to write image: " + path);
+}
+
+void write_png_rgb(const std::string& path, int width, int height, const unsigned char* pixels) {
+    if (!stbi_write_png(path.c_str(), width, height, 3, pixels, width * 3))
+        throw std::runtime_error("Failed to write image: " + path);
+}
@@ -0,0 +1,19 @@
+#ifndef IMAGE_WRITE_H
+#define IMAGE_WRITE_H
+
+#include <string>
+
+#include "framebuffer.h"
+#include "postprocess.h"
+
+// PNG output, defined in image_write.cpp, the one place stb_image_write is compiled
+
+/// runs the post pass over image and writes it as an 8-bit RGB PNG
+/// @throws std::runtime_error when the file cannot be written
+void write_png(const framebuffer& image, const std::string& path, const post_settings& post = post_settings());
+
+/// writes 8-bit RGB rows, top to bottom, as a PNG
+/// @throws std::runtime_error when the file cannot be written
+void write_png_rgb(const std::string& path, int width, int height, const unsigned char* pixels);
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "aabb.h"
+#include "accelerator.h"
+#include "bvh_wide.h"
+#include "primitive.h"
+#include "render_stats.h"
+
+/// A group of bounded primitives defined once in its own object space, with its
+/// own bottom-level hierarchy. Every instance placed from it shares both.
+class prototype {
+public:
+    /// @param objects  primitives of the group, they must outlive the prototype
+    explicit prototype(std::vector<primitive*> objects)
+      : prims(std::move(objects)), blas(prims)
+    {
+        for (auto* obj : prims) {
+            aabb box;
+            if (obj->bounding_box(box)) bounds.grow(box);
+        }
+    }
+
+    prototype(const prototype&) = delete;
+    prototype& operator=(const prototype&) = delete;
+
+    const accelerator& hierarchy() const { return blas; }
+    const aabb& get_bounds() const { return bounds; }
+    size_t size() const { return prims.size(); }
+
+private:
+    std::vector<primitive*> prims;
+    bvh8 blas;
+    aabb bounds;
+};
+
+/// A prototype placed in the scene by a similarity transform:
+/// world = R * (scale * local) + translation.
+/// Rays are moved into object space rather than the geometry into world space,
+/// so an instance costs a transform and a pointer however large its prototype is.
+class instance : public primitive {
+public:
+    /// @param scale  positive, zero or negative scales are rejected by the parser
+    /// @param axis, angle_deg  rotation about axis (any nonzero length), in degrees
+    instance(std::shared_ptr<const prototype> proto,
+             const vec3& translation,
+             real scale,
+             const vec3& axis,
+             double angle_deg)
+      : proto(std::move(proto)), translation(translation), scale(scale), inv_scale(1 / scale)
+    {
+        // Rodrigues' rotation formula
+        vec3 k = axis.length_squared() > 0 ? unit_vector(axis) : vec3(0, 1, 0);
+        double a = angle_deg * 3.14159265358979323846 / 180.0;
+        double c = std::cos(a), s = std::sin(a), t = 1 - c;
+        rot[0] = vec3(t*k.x()*k.x() + c,       t*k.x()*k.y() - s*k.z(), t*k.x()*k.z() + s*k.y());
+        rot[1] = vec3(t*k.x()*k.y() + s*k.z(), t*k.y()*k.y() + c,       t*k.y()*k.z() - s*k.x());
+        rot[2] = vec3(t*k.x()*k.z() - s*k.y(), t*k.y()*k.z() + s*k.x(), t*k.z()*k.z() + c);
+    }
+
+    bool hit(const ray& r, real ray_tmin, real ray_tmax, hit_struct& hit_out) const override {
+        COUNT_STAT(STAT_INSTANCE_TESTS);
+        // the local direction is not renormalized, so t means the same in both spaces
+        if (!proto->hierarchy().closest_hit(to_local(r), ray_tmin, ray_tmax, hit_out))
+            return false;
+        hit_out.placement = this; // hit_out.prim stays the prototype primitive that was hit
+        return true;
+    }
+
+    hit_surface surface_at(const ray& r, const hit_struct& hit) const override {
+        hit_surface s = hit.prim->surface_at(to_local(r), hit);
+        s.p = r.at(hit.t);
+        s.normal = unit_vector(rotate(s.normal));
+        return s;
+    }
+
+    bool any_hit(const ray& r, real ray_tmin, real ray_tmax) const override {
+        COUNT_STAT(STAT_INSTANCE_TESTS);
+        return proto->hierarchy().occluded(to_local(r), ray_tmin, ray_tmax);
+    }
+
+    // an instance has no color of its own: hit_struct::prim of an instance hit
+    // is the primitive inside the prototype, which is asked instead
+    color get_color_at(const ray& /*r*/, const hit_surface& /*surf*/) const override {
+        throw std::logic_error("instance::get_color_at called, shade hit_struct::prim instead");
+    }
+
+    bool bounding_box(aabb& box_out) const override {
+        const aabb& local = proto->get_bounds();
+        if (proto->size() == 0) return false; // nothing to bound, never hit
+        box_out = aabb();
+        for (int corner = 0; corner < 8; corner++) {
+            point3 p((corner & 1) ? local.hi.x() : local.lo.x(),
+                     (corner & 2) ? local.hi.y() : local.lo.y(),
+                     (corner & 4) ? local.hi.z() : local.lo.z());
+            box_out.grow(rotate(scale * p) + translation);
+        }
+        return true;
+    }
+
+private:
+    std::shared_ptr<const prototype> proto;
+    vec3 rot[3]; // rows of R
+    vec3 translation;
+    real scale;
+    real inv_scale;
+
+    vec3 rotate(const vec3& v) const {
+        return vec3(dot(rot[0], v), dot(rot[1], v), dot(rot[2], v));
+    }
+
+    // R^T v
+    vec3 unrotate(const vec3& v) const {
+        return v.x() * rot[0] + v.y() * rot[1] + v.z() * rot[2];
+    }
+
+    ray to_local(const ray& r) const {
+        return ray(inv_scale * unrotate(r.origin() - translation), inv_scale * unrotate(r.direction()));
+    }
+};
+
+#endif
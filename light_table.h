@@ -0,0 +1,93 @@
+#ifndef LIGHT_TABLE_H
+#define LIGHT_TABLE_H
+
+#include <cmath>
+#include <vector>
+
+#include "color.h"
+#include "directional_light.h"
+#include "light_source.h"
+#include "spotlight.h"
+#include "vec3.h"
+
+/// The lights of a scene compiled for shading: one flat array per light type
+/// holding everything that does not depend on the shaded point, evaluated
+/// without virtual calls. Lights that can never add anything are left out.
+class light_table {
+public:
+    /// every kind answers illuminate(P, Ldir, Li, tmax): false when the light adds
+    /// nothing at P, otherwise the unit direction toward it, its radiance and the
+    /// distance a shadow ray has to check
+    struct directional {
+        vec3 to_light; // negated light direction
+        color radiance;
+
+        bool illuminate(const point3& /*P*/, vec3& Ldir, color& Li, real& tmax) const {
+            Ldir = to_light;
+            Li = radiance;
+            tmax = INFINITY;
+            return true;
+        }
+    };
+
+    struct spot {
+        point3 position;
+        vec3 axis;   // unit, from the light toward the scene
+        real cutoff; // cosine of the cone half angle
+        color radiance;
+
+        bool illuminate(const point3& P, vec3& Ldir, color& Li, real& tmax) const {
+            vec3 d = position - P;
+            real dist = d.length();
+            Ldir = d / dist;
+            if (dot(-Ldir, axis) < cutoff) return false; // outside cone
+            Li = radiance;
+            tmax = dist; // up until the light source
+            return true;
+        }
+    };
+
+    /// light types the table does not know, evaluated through light_source
+    struct other {
+        const light_source* light;
+
+        bool illuminate(const point3& P, vec3& Ldir, color& Li, real& tmax) const {
+            Ldir = light->direction(P);
+            Li = light->intensityAt(P);
+            tmax = INFINITY;
+            return !(Li.x() == 0 && Li.y() == 0 && Li.z() == 0);
+        }
+    };
+
+    explicit light_table(const std::vector<light_source*>& lights) {
+        for (const light_source* L : lights) {
+            if (auto* d = dynamic_cast<const directional_light*>(L)) {
+                if (!is_black(d->get_radiance())) directionals.push_back({d->direction(point3()), d->get_radiance()});
+            } else if (auto* s = dynamic_cast<const spotlight*>(L)) {
+                if (!is_black(s->get_radiance()))
+                    spots.push_back({s->get_position(), s->get_axis(), s->get_cutoff(), s->get_radiance()});
+            } else {
+                others.push_back({L});
+            }
+        }
+    }
+
+    /// calls f once with the array of each light type, f must accept all of them
+    template <typename F>
+    void for_each_kind(F&& f) const {
+        f(directionals);
+        f(spots);
+        f(others);
+    }
+
+    size_t size() const { return directionals.size() + spots.size() + others.size(); }
+
+private:
+    std::vector<directional> directionals;
+    std::vector<spot> spots;
+    std::vector<other> others;
+
+    static bool is_black(const color& c) { return c.x() == 0 && c.y() == 0 && c.z() == 0; }
+};
+
+#endif
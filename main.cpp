@@ -1,19 +1,44 @@
-#include "color.h"
-#include "parser.h"
-#include "camera.h"
-#include "sphere.h"
-#include "definitions.h"
+#include "hw2core.h"
+#include "render_stats.h"
 
+#include <cmath>
 #include <iostream>
-#include <vector>
+#include <mutex>
 #include <string>
 
 #define DEFAULT_RESOLUTION 384
 #define DAFAULT_GAMMA 1.0
+#define DEFAULT_ACCEL "auto"
+
+// value of --exposure or --gamma, kept as it was unless text is a finite number above zero
+static void read_positive(const std::string& flag, const char* text, float& value) {
+    try {
+        size_t used = 0;
+        float parsed = std::stof(text, &used);
+        if (text[used] == '\0' && std::isfinite(parsed) && parsed > 0) {
+            value = parsed;
+            return;
+        }
+    } catch (...) {
+    }
+    std::cerr << "Invalid " << flag << " value " << text << ", using default.\n";
+}
+
+// value of --seed, a 32-bit unsigned integer, or -1 (the clock) when text is not one
+static long long read_seed(const char* text) {
+    try {
+        size_t used = 0;
+        long long seed = std::stoll(text, &used);
+        if (text[used] == '\0' && seed >= 0 && seed <= 0xffffffffLL) return seed;
+    } catch (...) {
+    }
+    std::cerr << "Invalid --seed value " << text << ", seeding from the clock.\n";
+    return -1;
+}
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <scene_name_without_extension>\n";
+        std::cerr << "Usage: " << argv[0] << " <scene_name_without_extension> [resolution] [--accel auto|bvh2|bvh4|bvh8|bvh4c|grid] [--cache|--no-cache] [--wavefront [--no-ray-sort]] [--exposure E] [--gamma G|--srgb] [--dither] [--stats] [--stats-json file] [--heatmap|--heatmap-pixels] [--trace file] [--seed N]\n";
         return 1;
     }
 
@@ -22,50 +47,77 @@ int main(int argc, char* argv[]) {
     std::string output_file = "output_" + input_name + ".png";
 
     // Default values
-    int px_height = DEFAULT_RESOLUTION;
-    int px_width = DEFAULT_RESOLUTION;
-    double gamma = DAFAULT_GAMMA;
+    render_options options;
+    options.width = options.height = DEFAULT_RESOLUTION;
+    options.accel = DEFAULT_ACCEL;
+    options.cache_prefix = input_name; // e.g. scene1.bvh8.cache, only for large scenes
+    post_settings post;
+    post.gamma = DAFAULT_GAMMA;
+    bool print_stats = false;
+    std::string stats_json;
+    std::string trace_json;
 
     // Optional - Get resolution from input
-    if (argc >= 3) {
+    if (argc >= 3 && argv[2][0] != '-') {
         try {
             int resolution = std::stoi(argv[2]);
-            px_height = px_width = resolution;
+            options.width = options.height = resolution;
             std::cout << "Got resolution: " << resolution << "\n";
         } catch (...) {
             std::cerr << "Invalid resolution, using default.\n";
         }
     }
 
-    // Load and parse scene
-    parser scene_parser;
-    scene_parser.load(scene_file);
-
-    // Get scene objects
-    auto scene_objects = scene_parser.get_scene_objects();
-    auto light_sources = scene_parser.get_lights();
-    auto ambient = scene_parser.get_ambient();
-
-    // Add to scene
-    std::vector<primitive*> scene;
-    for (const auto& obj : scene_objects) {
-        obj.shape->set_material(obj.material);
-        scene.push_back(obj.shape);
+    // Optional flags
+    for (int a = 2; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--accel" && a + 1 < argc) options.accel = argv[++a];
+        else if (arg == "--cache") options.cache_min_objects = 0;
+        else if (arg == "--no-cache") options.cache_prefix.clear();
+        else if (arg == "--wavefront") options.wavefront = true;
+        else if (arg == "--no-ray-sort") options.shadow_ray_sorting = false;
+        else if (arg == "--exposure" && a + 1 < argc) read_positive(arg, argv[++a], post.exposure);
+        else if (arg == "--gamma" && a + 1 < argc) read_positive(arg, argv[++a], post.gamma);
+        else if (arg == "--srgb") post.srgb = true;
+        else if (arg == "--dither") post.dither = true;
+        else if (arg == "--stats") print_stats = true;
+        else if (arg == "--stats-json" && a + 1 < argc) stats_json = argv[++a];
+        else if (arg == "--heatmap") options.heatmap_path = "heatmap_" + input_name + ".png";
+        else if (arg == "--heatmap-pixels") {
+            options.heatmap_path = "heatmap_" + input_name + ".png";
+            options.heatmap_pixels = true;
+        }
+        else if (arg == "--trace" && a + 1 < argc) trace_json = argv[++a];
+        // reproducible images, e.g. for the golden image test
+        else if (arg == "--seed" && a + 1 < argc) options.seed = read_seed(argv[++a]);
     }
 
-    // Camera
-    auto camera_center = scene_parser.get_eye();
-    camera cam(camera_center, px_height, px_width, color(0, 0, 0)); // black bg
+    if (!trace_json.empty()) tracer::get().enable();
+
+    // the library prints nothing, its news and the progress go to the console here;
+    // wavefront tiles finish on several threads at once
+    std::mutex console;
+    options.log = [&console](const std::string& line) {
+        std::lock_guard<std::mutex> lock(console);
+        std::cout << '\r' << line << "\n";
+    };
+    const char* unit = options.wavefront ? "Tiles" : "Scanlines";
+    auto progress = [&console, unit](size_t done, size_t total) {
+        std::lock_guard<std::mutex> lock(console);
+        std::cout << '\r' << unit << " remaining: " << (total - done) << ' ' << std::flush;
+    };
 
-    // get anti-aliasing samples from 4th value of e
-    int aa_samples = scene_parser.get_aa_samples();
+    // Load and parse scene, the acceleration structure is built by the first render
+    renderer scene_renderer;
+    scene_renderer.load(scene_file);
 
     // render
-    cam.render(scene, light_sources, ambient, output_file, aa_samples, gamma);
+    write_png(scene_renderer.render(options, progress), output_file, post);
+    std::cout << "\rDone.               \n";
 
-    // Clean up memory
-    for (auto* obj : scene) delete obj;
-    for (auto* l : light_sources) delete l;
+    if (print_stats) render_stats::get().print(std::cout);
+    if (!stats_json.empty()) render_stats::get().write_json(stats_json);
+    if (!trace_json.empty()) tracer::get().write(trace_json);
 
     return 0;
 }
@@ -0,0 +1,36 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstdint>
+
+#include "util.h"
+
+// spreads the low 10 bits of v so there are two zero bits between each of them
+inline uint32_t expand_bits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code of a point given in [0,1]^3
+inline uint32_t morton3d(double x, double y, double z) {
+    uint32_t ix = uint32_t(clamp(x * 1024.0, 0.0, 1023.0));
+    uint32_t iy = uint32_t(clamp(y * 1024.0, 0.0, 1023.0));
+    uint32_t iz = uint32_t(clamp(z * 1024.0, 0.0, 1023.0));
+    return (expand_bits(ix) << 2) | (expand_bits(iy) << 1) | expand_bits(iz);
+}
+
+// count of leading zero bits, 32 for zero
+inline int clz32(uint32_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return v == 0 ? 32 : __builtin_clz(v);
+#else
+    int n = 0;
+    for (uint32_t bit = 0x80000000u; bit != 0 && !(v & bit); bit >>= 1) n++;
+    return n;
+#endif
+}
+
+#endif
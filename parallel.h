@@ -0,0 +1,56 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// number of threads the parallel helpers spread work over
+inline unsigned worker_count() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+// number of chunks to split count items into so each gets at least min_per_chunk
+inline unsigned chunk_count(size_t count, size_t min_per_chunk = 4096) {
+    size_t by_size = std::max<size_t>(1, count / std::max<size_t>(1, min_per_chunk));
+    return unsigned(std::min<size_t>(worker_count(), by_size));
+}
+
+// splits [0, count) into `chunks` contiguous ranges and calls fn(chunk, begin, end)
+// for each of them on its own thread, the last one on the calling thread;
+// once every chunk has returned or thrown, rethrows what the lowest chunk threw
+template <typename F>
+void parallel_chunks(size_t count, unsigned chunks, F&& fn) {
+    if (chunks <= 1) {
+        fn(0u, size_t(0), count);
+        return;
+    }
+    std::vector<std::exception_ptr> errors(chunks);
+    auto run = [&fn, &errors, count, chunks](unsigned c) {
+        try {
+            fn(c, count * c / chunks, count * (c + 1) / chunks);
+        } catch (...) {
+            errors[c] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+    for (unsigned c = 0; c + 1 < chunks; c++) workers.emplace_back(run, c);
+    run(chunks - 1);
+    for (auto& w : workers) w.join();
+    for (const auto& e : errors)
+        if (e) std::rethrow_exception(e);
+}
+
+// calls fn(i) for every i in [0, count), spread over the worker threads
+template <typename F>
+void parallel_for(size_t count, F&& fn, size_t min_per_chunk = 4096) {
+    parallel_chunks(count, chunk_count(count, min_per_chunk), [&fn](unsigned, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) fn(i);
+    });
+}
+
+#endif
@@ -1,26 +1,25 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <cmath>
 #include <iostream>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <memory>
 
 #include "vec3.h"
 #include "sphere.h"
 #include "plane.h"
+#include "instance.h"
 #include "primitive.h"
 #include "color.h"
 #include "light_source.h"
 #include "spotlight.h"
 #include "directional_light.h"
 #include "definitions.h"
-
-struct scene_object {
-  primitive*   shape;
-  material_t   material;
-};
+#include "scene_data.h"
 
 class parser{
     public:
@@ -73,55 +72,125 @@ class parser{
             throw std::runtime_error("No 'e' (eye) line found in scene file.");
         }        
 
-        // Get scene objects
-        std::vector<scene_object> get_scene_objects(){
-            std::vector<scene_object> result;
+        // Get scene objects, allocated in and added to scene
+        // Objects between a 'g' and a 'G' line form a prototype group, numbered in
+        // order of definition, paired with the 'c' lines of the same block. Groups
+        // are not rendered themselves, 'n' lines place instances of them:
+        //   n <group> <tx> <ty> <tz> [scale] [axis_x axis_y axis_z angle_degrees]
+        void get_scene_objects(scene_data& scene){
             std::vector<material_t> materials;
+            std::vector<std::vector<material_t>> group_materials;
         
             // First collect materials
+            int group = -1;
             for(const auto& line : lines){
                 std::istringstream iss(line);
                 std::string id;
                 iss >> id;
         
-                if(id == "c"){
+                if(id == "g"){
+                    group_materials.emplace_back();
+                    group = int(group_materials.size()) - 1;
+                } else if(id == "G"){
+                    group = -1;
+                } else if(id == "c"){
                     double r, g, b, shininess;
                     iss >> r >> g >> b >> shininess;
                     material_t mat;
                     mat.ambient = color(r, g, b);
                     mat.diffuse = color(r, g, b);
                     mat.shininess = shininess;
-                    materials.push_back(mat);
+                    (group < 0 ? materials : group_materials[group]).push_back(mat);
                 }
             }
         
             size_t mat_index = 0;
+            std::vector<std::vector<primitive*>> group_objects(group_materials.size());
+            std::vector<std::string> instance_lines;
+            int groups_seen = 0;
+            group = -1;
         
             for(const auto& line : lines){
                 std::istringstream iss(line);
                 std::string id;
                 iss >> id;
         
-                if(id == "o" || id == "t" || id == "r"){
+                if(id == "g"){
+                    group = groups_seen++;
+                } else if(id == "G"){
+                    group = -1;
+                } else if(id == "n"){
+                    instance_lines.push_back(line);
+                } else if(id == "o" || id == "t" || id == "r"){
                     double x, y, z, w;
                     iss >> x >> y >> z >> w;
         
+                    if(group >= 0){
+                        if(w <= 0)
+                            throw std::runtime_error("Planes cannot be part of an instanced group: " + line);
+                        const auto& mats = group_materials[group];
+                        size_t index = group_objects[group].size();
+                        primitive* obj = scene.create<sphere>(point3(x, y, z), w);
+                        obj->set_material(index < mats.size() ? mats[index] : material_t{});
+                        group_objects[group].push_back(obj);
+                        continue;
+                    }
+        
                     primitive* obj = nullptr;
                     if(w > 0){ // Sphere
-                        obj = new sphere(point3(x, y, z), w);
+                        obj = scene.create<sphere>(point3(x, y, z), w);
                     } else { // Plane
-                        obj = new plane(x, y, z, w);
+                        obj = scene.create<plane>(x, y, z, w);
                     }
         
                     if(!obj) continue;
         
                     material_t mat = mat_index < materials.size() ? materials[mat_index] : material_t{};
-                    result.push_back({obj, mat});
+                    obj->set_material(mat);
+                    scene.add_object(obj);
                     mat_index++;
                 }
             }
         
-            return result;
+            // each group gets its own bottom-level hierarchy, shared by its instances
+            std::vector<std::shared_ptr<const prototype>> prototypes;
+            for(auto& objects : group_objects)
+                prototypes.push_back(std::make_shared<const prototype>(std::move(objects)));
+        
+            for(const auto& line : instance_lines){
+                std::istringstream iss(line);
+                std::string id, group_token;
+                double tx, ty, tz;
+                iss >> id >> group_token >> tx >> ty >> tz;
+                size_t group_index = 0;
+                if(!iss || !parse_index(group_token, group_index) || group_index >= prototypes.size())
+                    throw std::runtime_error("Invalid instance line: " + line);
+        
+                // scale, then optionally the rotation, nothing else but a comment may follow
+                double scale = 1.0, ax = 0.0, ay = 1.0, az = 0.0, angle = 0.0;
+                double s, x, y, z, deg;
+                if(iss >> s){
+                    scale = s;
+                    if(iss >> x){
+                        if(!(iss >> y >> z >> deg))
+                            throw std::runtime_error("Incomplete instance rotation: " + line);
+                        ax = x; ay = y; az = z; angle = deg;
+                    }
+                }
+                iss.clear();
+                iss >> std::ws;
+                if(!iss.eof() && iss.peek() != '#')
+                    throw std::runtime_error("Unexpected values on instance line: " + line);
+                // zero would give an infinite inverse scale, a negative one mirrors
+                // the geometry without flipping its normals
+                if(!(scale > 0.0) || !std::isfinite(scale))
+                    throw std::runtime_error("Instance scale must be positive: " + line);
+                if(angle != 0.0 && ax == 0.0 && ay == 0.0 && az == 0.0)
+                    throw std::runtime_error("Instance rotation axis is zero: " + line);
+        
+                primitive* obj = scene.create<instance>(prototypes[group_index], vec3(tx, ty, tz), scale, vec3(ax, ay, az), angle);
+                scene.add_object(obj);
+            }
         }
 
         // Get ambient color
@@ -139,7 +208,8 @@ class parser{
             throw std::runtime_error("Ambient light not found.");
         }
 
-        std::vector<light_source*> get_lights() {
+        // Get lights, allocated in and added to scene
+        void get_lights(scene_data& scene) {
             std::vector<std::pair<vec3, double>> rawDirs;   // pair of direction and w (0=dir, 1=spot)
             std::vector<point3> positions;
             std::vector<double> cutoffs;
@@ -168,7 +238,6 @@ class parser{
                 }
             }
 
-            std::vector<light_source*> result;
             size_t spotIndex = 0;
 
             for (size_t idx = 0; idx < rawDirs.size(); idx++) {
@@ -179,12 +248,12 @@ class parser{
 
                 if (w == 0.0) {
                     // Directional light: w == 0
-                    result.push_back(new directional_light(dirVec, col));
+                    scene.add_light(scene.create<directional_light>(dirVec, col));
                 } else {
                     // Spotlight: w == 1
                     if (spotIndex < positions.size() && spotIndex < cutoffs.size()) {
-                        result.push_back(
-                            new spotlight(
+                        scene.add_light(
+                            scene.create<spotlight>(
                                 positions[spotIndex],   
                                 dirVec,                 
                                 cutoffs[spotIndex],     
@@ -195,12 +264,22 @@ class parser{
                     }
                 }
             }
-            
-            return result;
         } 
         
     private:
         std::vector<std::string> lines;
+
+        // a whole token of decimal digits, so "0.7" or "1x" are not read as 0 or 1
+        static bool parse_index(const std::string& token, size_t& index_out){
+            if(token.empty() || token.size() > 9) return false;
+            size_t index = 0;
+            for(char ch : token){
+                if(ch < '0' || ch > '9') return false;
+                index = index * 10 + size_t(ch - '0');
+            }
+            index_out = index;
+            return true;
+        }
 };
 
 #endif
\ No newline at end of file
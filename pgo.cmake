@@ -0,0 +1,62 @@
+# Two-stage profile guided build of hw2, run by the hw2_pgo target as
+# cmake -P pgo.cmake with SOURCE_DIR, PGO_DIR, CXX_COMPILER, COMPILER_ID,
+# PROFDATA, SCENEGEN, NATIVE and OUTPUT set. Builds an instrumented hw2 in
+# PGO_DIR, trains it on the bundled scenes and a generated large scene through
+# both render paths, rebuilds it in the same directory with the profile and
+# copies the result to OUTPUT.
+
+set(build_dir ${PGO_DIR}/build)
+set(profile_dir ${PGO_DIR}/profile)
+set(train_dir ${PGO_DIR}/train)
+
+function(run_checked)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "PGO step failed (${result}): ${ARGN}")
+    endif()
+endfunction()
+
+# same build directory for both stages, GCC finds each object's profile next to it
+function(build_stage stage)
+    message(STATUS "PGO: building the ${stage} stage")
+    run_checked(${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${build_dir}
+                -DCMAKE_BUILD_TYPE=Release -DCMAKE_CXX_COMPILER=${CXX_COMPILER}
+                -DHW2_NATIVE=${NATIVE} -DHW2_PGO=${stage} -DHW2_PGO_DIR=${profile_dir})
+    run_checked(${CMAKE_COMMAND} --build ${build_dir} --target hw2)
+endfunction()
+
+file(REMOVE_RECURSE ${PGO_DIR})
+file(MAKE_DIRECTORY ${profile_dir} ${train_dir})
+build_stage(generate)
+
+# training runs, the same work hw2 sees in use: small bundled scenes and a
+# large generated one, through the scanline and the wavefront renderer
+set(scenes scene1 scene2 scene3 scene4 scene5 our_scene1 our_scene2 our_scene2aa our_scene3)
+foreach(scene ${scenes})
+    file(COPY ${SOURCE_DIR}/${scene}.txt DESTINATION ${train_dir})
+endforeach()
+execute_process(COMMAND ${SCENEGEN} -o ${train_dir}/pgo_large.txt --spheres 50000 --planes 2 --spots 1
+                RESULT_VARIABLE result)
+if(result EQUAL 0)
+    list(APPEND scenes pgo_large)
+endif()
+message(STATUS "PGO: training on ${scenes}")
+foreach(scene ${scenes})
+    foreach(path "" "--wavefront")
+        execute_process(COMMAND ${build_dir}/hw2 ${scene} --no-cache --seed 1 ${path}
+                        WORKING_DIRECTORY ${train_dir} OUTPUT_QUIET RESULT_VARIABLE result)
+        if(NOT result EQUAL 0)
+            message(FATAL_ERROR "PGO training run failed on ${scene} ${path}")
+        endif()
+    endforeach()
+endforeach()
+
+# clang writes raw profiles that are merged into one first
+if(COMPILER_ID MATCHES "Clang")
+    file(GLOB raw_profiles ${profile_dir}/*.profraw)
+    run_checked(${PROFDATA} merge -output=${profile_dir}/hw2.profdata ${raw_profiles})
+endif()
+
+build_stage(use)
+run_checked(${CMAKE_COMMAND} -E copy ${build_dir}/hw2 ${OUTPUT})
+message(STATUS "PGO: wrote ${OUTPUT}")
@@ -2,6 +2,7 @@
 #define PLANE_H
 
 #include "primitive.h"
+#include "render_stats.h"
 #include "vec3.h"
 
 class plane : public primitive {
@@ -14,30 +15,38 @@ public:
         this->d  = d / n.length(); // normalize d too
     }
 
-    bool hit(const ray& r, double ray_tmin, double ray_tmax, hit_struct& hit_out) const override {
+    bool hit(const ray& r, real ray_tmin, real ray_tmax, hit_struct& hit_out) const override {
+        COUNT_STAT(STAT_PLANE_TESTS);
         // Plane intersection: t = -(a·o + d) / (a·d)
-        double denom = dot(normal, r.direction());
+        real denom = dot(normal, r.direction());
         if (std::abs(denom) < 1e-6) return false; // Ray is parallel to the plane
 
-        double t = -(dot(normal, r.origin()) + d) / denom;
+        real t = -(dot(normal, r.origin()) + d) / denom;
         if (t < ray_tmin || t > ray_tmax) return false;
 
         hit_out.t = t;
-        hit_out.p = r.at(t);
-        hit_out.normal = normal; // already normalized in constructor
+        hit_out.prim = this;
+        hit_out.placement = nullptr;
 
         return true;
     }
 
-    color get_color_at(const ray& /*r*/, const hit_struct& hit) const override 
+    hit_surface surface_at(const ray& r, const hit_struct& hit) const override {
+        hit_surface s;
+        s.p = r.at(hit.t);
+        s.normal = normal; // already normalized in constructor
+        return s;
+    }
+
+    color get_color_at(const ray& /*r*/, const hit_surface& surf) const override 
     {
-        color base = checkerboard_color(material.ambient, hit.p);
+        color base = checkerboard_color(material.ambient, surf.p);
         return base;
     }
 
 private:
     vec3 normal;
-    double d;
+    real d;
 
     color checkerboard_color(const color& rgb, const point3 hitPoint) const {
         const float scale = 0.5f;
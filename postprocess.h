@@ -0,0 +1,137 @@
+#ifndef POSTPROCESS_H
+#define POSTPROCESS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define POSTPROCESS_SSE 1
+#endif
+
+#include "framebuffer.h"
+#include "parallel.h"
+#include "rng.h"
+
+#define TONE_LUT_SIZE 1024 // intervals of the tone curve table
+#define DITHER_TABLE_SIZE 4096 // noise values, power of two
+
+// how the float framebuffer becomes 8-bit pixels
+struct post_settings {
+    float exposure = 1;  // linear scale applied first
+    float gamma = 1;     // output = input^gamma, unused with srgb
+    bool srgb = false;   // sRGB transfer curve instead of gamma
+    bool dither = false; // add up to half a step of noise before rounding, hides banding
+    uint32_t seed = 0;   // of the dither noise
+};
+
+// Post-processing pass: exposure, clamp to [0, 1], tone curve and 8-bit
+// quantization, parallel over rows and four channel values at a time with SSE.
+// The curve is a table over sqrt(x) with linear interpolation, which stays
+// accurate near black where x^(1/2.2) is steepest: for gamma 1/2.2, 2.2 and
+// sRGB it stays within a thousandth of a step of the exact curve. Without a curve (gamma 1)
+// the table is skipped and, without dithering, values quantize as write_color does.
+// Dither noise comes from a table of hashed values read at a per-row offset.
+class post_pass {
+public:
+    explicit post_pass(const post_settings& settings) : settings(settings) {
+        identity = !settings.srgb && settings.gamma == 1.0f;
+        for (int k = 0; k <= TONE_LUT_SIZE; k++) {
+            double u = double(k) / TONE_LUT_SIZE;
+            lut[k].value = float(curve(u * u));
+        }
+        // the last entry has no slope, so x == 1 needs no special case
+        for (int k = 0; k <= TONE_LUT_SIZE; k++)
+            lut[k].slope = k < TONE_LUT_SIZE ? lut[k + 1].value - lut[k].value : 0.0f;
+        if (settings.dither) {
+            noise.resize(DITHER_TABLE_SIZE);
+            for (uint32_t k = 0; k < DITHER_TABLE_SIZE; k++)
+                noise[k] = float(pcg_hash(k ^ settings.seed)) * (1.0f / 4294967296.0f);
+        }
+    }
+
+    /// @param out  width * height * 3 bytes, resized as needed
+    void run(const framebuffer& in, std::vector<unsigned char>& out) const {
+        size_t row = size_t(in.width()) * 3;
+        out.resize(row * in.height());
+        parallel_for(size_t(in.height()), [&](size_t j) {
+            // offset is a multiple of four so a block of four values never wraps
+            uint32_t offset = pcg_hash(uint32_t(j)) & (DITHER_TABLE_SIZE - 4);
+            run_span(in.data() + j * row, out.data() + j * row, row, offset);
+        }, 16);
+    }
+
+    /// the exact curve the table approximates, x in [0, 1]
+    double curve(double x) const {
+        if (settings.srgb) return x <= 0.0031308 ? 12.92 * x : 1.055 * std::pow(x, 1 / 2.4) - 0.055;
+        return std::pow(x, double(settings.gamma));
+    }
+
+private:
+    struct lut_entry {
+        float value;
+        float slope; // to the next entry
+    };
+
+    post_settings settings;
+    bool identity;
+    lut_entry lut[TONE_LUT_SIZE + 1];
+    std::vector<float> noise; // uniform in [0, 1), only when dithering
+
+    // n values of one row, noise read from noise[(offset + k) % DITHER_TABLE_SIZE]
+    void run_span(const float* in, unsigned char* out, size_t n, uint32_t offset) const {
+        size_t k = 0;
+#if defined(POSTPROCESS_SSE)
+        const __m128 exposure = _mm_set1_ps(settings.exposure);
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        const __m128 lut_scale = _mm_set1_ps(float(TONE_LUT_SIZE));
+        // without dither truncate v * 255.999 like write_color, with dither
+        // truncate v * 255 + noise, noise in [0, 1) averaging to the rounded value
+        const __m128 to_byte = _mm_set1_ps(settings.dither ? 255.0f : 255.999f);
+        for (; k + 4 <= n; k += 4) {
+            // max first so NaN becomes 0
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + k), exposure), zero), one);
+            if (!identity) {
+                __m128 x = _mm_mul_ps(_mm_sqrt_ps(v), lut_scale);
+                __m128i i = _mm_cvttps_epi32(x);
+                __m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(i));
+                alignas(16) int32_t idx[4];
+                _mm_store_si128(reinterpret_cast<__m128i*>(idx), i);
+                // one 8 byte load per lane, then transposed into values and slopes
+                __m128 e01 = _mm_loadh_pi(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(&lut[idx[0]]))),
+                                          reinterpret_cast<const __m64*>(&lut[idx[1]]));
+                __m128 e23 = _mm_loadh_pi(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(&lut[idx[2]]))),
+                                          reinterpret_cast<const __m64*>(&lut[idx[3]]));
+                __m128 value = _mm_shuffle_ps(e01, e23, _MM_SHUFFLE(2, 0, 2, 0));
+                __m128 slope = _mm_shuffle_ps(e01, e23, _MM_SHUFFLE(3, 1, 3, 1));
+                v = _mm_add_ps(value, _mm_mul_ps(f, slope));
+            }
+            v = _mm_mul_ps(v, to_byte);
+            if (settings.dither)
+                v = _mm_add_ps(v, _mm_loadu_ps(&noise[(offset + k) & (DITHER_TABLE_SIZE - 1)]));
+            __m128i q = _mm_cvttps_epi32(v);
+            q = _mm_packs_epi32(q, q);
+            q = _mm_packus_epi16(q, q); // also clamps 256 from dithered white
+            int32_t bytes = _mm_cvtsi128_si32(q);
+            std::memcpy(out + k, &bytes, 4);
+        }
+#endif
+        for (; k < n; k++) {
+            float v = std::min(std::max(in[k] * settings.exposure, 0.0f), 1.0f);
+            if (std::isnan(v)) v = 0;
+            if (!identity) {
+                float x = std::sqrt(v) * TONE_LUT_SIZE;
+                int i = int(x);
+                v = lut[i].value + (x - float(i)) * lut[i].slope;
+            }
+            int q = settings.dither ? int(v * 255.0f + noise[(offset + k) & (DITHER_TABLE_SIZE - 1)])
+                                    : int(v * 255.999f);
+            out[k] = (unsigned char)std::min(q, 255);
+        }
+    }
+};
+
+#endif
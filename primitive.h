@@ -2,31 +2,55 @@
 #define PRIMITIVE_H
 
 #include "ray.h"
+#include "aabb.h"
 #include "color.h"
 #include "definitions.h"
 
 class primitive;
+// what traversal keeps of a hit, kept small because it is copied for every closer hit
 class hit_struct{
     public:
-        point3 p;
-        vec3 normal;
-        double t;
-        primitive* prim;
+        real t;
+        const primitive* prim;                // set by the primitive that was hit
+        const primitive* placement = nullptr; // the instance prim was reached through, if any
+};
+
+// hit point and normal, only computed for the closest hit (see resolve_hit)
+struct hit_surface {
+    point3 p;
+    vec3 normal;
 };
 
 class primitive
 {
 public:
     virtual ~primitive() = default;
-    virtual bool hit(const ray& r, double ray_tmin, double ray_tmax, hit_struct& hit_out) const = 0;
-    virtual color get_color_at(const ray&  r, const hit_struct&  hit) const = 0;
+    virtual bool hit(const ray& r, real ray_tmin, real ray_tmax, hit_struct& hit_out) const = 0;
+    // occlusion query, only has to answer whether any hit exists
+    virtual bool any_hit(const ray& r, real ray_tmin, real ray_tmax) const {
+        hit_struct tmp;
+        return hit(r, ray_tmin, ray_tmax, tmp);
+    }
+    // point and unit normal of a hit this primitive reported for r
+    virtual hit_surface surface_at(const ray& r, const hit_struct& hit) const = 0;
+    virtual color get_color_at(const ray&  r, const hit_surface&  surf) const = 0;
+    // false for unbounded primitives (planes), which acceleration structures keep aside
+    virtual bool bounding_box(aabb& /*box_out*/) const { return false; }
     
     const material_t& get_metrial() const { return material; }
-    void set_material(const material_t& m) { material = m; }
+    void set_material(const material_t& m) {
+        material = m;
+        material.specular = specular_power(m.shininess);
+    }
 
 protected:
     material_t material;
 };
 
+// point and normal of the hit returned by a closest hit query
+inline hit_surface resolve_hit(const ray& r, const hit_struct& hit) {
+    return (hit.placement ? hit.placement : hit.prim)->surface_at(r, hit);
+}
+
 #endif
 
@@ -0,0 +1,55 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.h"
+
+#define RADIX_DIGIT_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_DIGIT_BITS)
+
+// Stable parallel LSD radix sort of keys, carrying values along.
+// Only the low key_bits bits of each key take part in the ordering.
+inline void radix_sort_pairs(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, unsigned key_bits = 32) {
+    size_t n = keys.size();
+    std::vector<uint32_t> keys_tmp(n), values_tmp(n);
+
+    // every pass splits the input the same way, so chunk c always owns the same range
+    unsigned chunks = chunk_count(n, 1 << 16);
+    std::vector<size_t> offsets(size_t(chunks) * RADIX_BUCKETS);
+
+    for (unsigned shift = 0; shift < key_bits; shift += RADIX_DIGIT_BITS) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_chunks(n, chunks, [&](unsigned c, size_t begin, size_t end) {
+            size_t* hist = &offsets[size_t(c) * RADIX_BUCKETS];
+            for (size_t i = begin; i < end; i++)
+                hist[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        });
+
+        // exclusive scan in (digit, chunk) order keeps equal digits in input order
+        size_t sum = 0;
+        for (size_t d = 0; d < RADIX_BUCKETS; d++) {
+            for (unsigned c = 0; c < chunks; c++) {
+                size_t count = offsets[c * RADIX_BUCKETS + d];
+                offsets[c * RADIX_BUCKETS + d] = sum;
+                sum += count;
+            }
+        }
+
+        parallel_chunks(n, chunks, [&](unsigned c, size_t begin, size_t end) {
+            size_t* pos = &offsets[size_t(c) * RADIX_BUCKETS];
+            for (size_t i = begin; i < end; i++) {
+                size_t dst = pos[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                keys_tmp[dst] = keys[i];
+                values_tmp[dst] = values[i];
+            }
+        });
+
+        keys.swap(keys_tmp);
+        values.swap(values_tmp);
+    }
+}
+
+#endif
@@ -0,0 +1,254 @@
+// End-to-end render benchmark. Runs hw2 as a child process on the bundled
+// scenes and on generated scenes that sweep object count, light count,
+// resolution and anti-aliasing one at a time from a fixed baseline, and writes
+// wall time, render time, rays per second and peak resident memory to a CSV.
+// Rays per second count shadow rays too when hw2 is built with HW2_RENDER_STATS,
+// otherwise primary rays only.
+//
+// Several builds of hw2 (e.g. release, native and pgo) are compared with one
+// --config label=path each; every case runs on all of them in turn and the
+// speedup column is the wall time of the first one over this one.
+//
+// Usage: hw2_render_bench [--hw2 path | --config label=path ...] [--scenes dir]
+//                         [--out file.csv] [--repeats n] [--quick]
+//                         [-- extra hw2 arguments]
+
+#include "scene_gen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef HW2_SOURCE_DIR
+#define HW2_SOURCE_DIR "."
+#endif
+
+#define RENDER_BENCH_RESOLUTION 384 // bundled scenes, the hw2 default
+#define SWEEP_OBJECTS 10000         // baseline of the generated sweeps
+#define SWEEP_LIGHTS 2
+#define SWEEP_RESOLUTION 256
+#define SWEEP_AA 1
+
+namespace fs = std::filesystem;
+
+struct render_case {
+    std::string group;  // bundled, objects, lights, resolution or aa
+    std::string scene;  // file name without .txt inside the work directory
+    size_t objects;
+    size_t lights;
+    int resolution;
+    int aa;
+};
+
+// a build of hw2 to time
+struct hw2_config {
+    std::string label;
+    std::string path;
+};
+
+struct run_result {
+    double wall_s = 0;
+    double render_s = 0;     // render phase reported by hw2
+    long long shadow_rays = -1; // only reported by builds with HW2_RENDER_STATS
+    double peak_rss_mb = 0;
+};
+
+// number after "key": in a flat JSON text, fallback if it is missing
+static double json_number(const std::string& text, const std::string& key, double fallback) {
+    size_t at = text.find("\"" + key + "\": ");
+    if (at == std::string::npos) return fallback;
+    return std::strtod(text.c_str() + at + key.size() + 4, nullptr);
+}
+
+// runs hw2 once inside workdir with its output discarded
+static run_result run_hw2(const std::string& hw2, const fs::path& workdir, const render_case& c,
+                          const std::vector<std::string>& extra_args) {
+    fs::path stats = workdir / (c.scene + ".stats.json");
+    std::vector<std::string> args = {hw2, c.scene, std::to_string(c.resolution), "--no-cache",
+                                     "--stats-json", stats.string()};
+    args.insert(args.end(), extra_args.begin(), extra_args.end());
+    std::vector<char*> argv;
+    for (auto& a : args) argv.push_back(a.data());
+    argv.push_back(nullptr);
+
+    auto t0 = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        if (chdir(workdir.c_str()) != 0) _exit(126);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) throw std::runtime_error("wait4 failed");
+    auto t1 = std::chrono::steady_clock::now();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("hw2 failed on " + c.scene + " (exit status " + std::to_string(WEXITSTATUS(status)) + ")");
+
+    run_result r;
+    r.wall_s = std::chrono::duration<double>(t1 - t0).count();
+    r.peak_rss_mb = double(usage.ru_maxrss) / 1024.0; // kilobytes on Linux
+    std::ifstream in(stats);
+    std::stringstream text;
+    text << in.rdbuf();
+    r.render_s = json_number(text.str(), "render", 0.0) * 1e-3;
+    r.shadow_rays = (long long)json_number(text.str(), "shadow_rays", -1.0);
+    return r;
+}
+
+// object, light and anti-aliasing counts of a scene file; objects are counted
+// as the parser adds them to the scene: spheres and planes (o, t, r) outside
+// a g ... G group and instances of a group (n)
+static void describe_scene(const fs::path& path, render_case& c) {
+    std::ifstream in(path);
+    std::string line;
+    c.objects = c.lights = 0;
+    c.aa = 1;
+    bool in_group = false;
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        std::string id;
+        iss >> id;
+        if (id == "g") in_group = true;
+        else if (id == "G") in_group = false;
+        else if (id == "n" || (!in_group && (id == "o" || id == "t" || id == "r"))) c.objects++;
+        else if (id == "d") c.lights++;
+        else if (id == "e") {
+            double x, y, z, w;
+            if (iss >> x >> y >> z >> w) c.aa = std::max(1, int(w));
+        }
+    }
+}
+
+static render_case generated_case(const fs::path& workdir, const std::string& group,
+                                  size_t objects, size_t lights, int resolution, int aa) {
+    render_case c{group, "gen_" + group + "_" + std::to_string(objects) + "_" + std::to_string(lights) + "_"
+                  + std::to_string(resolution) + "_" + std::to_string(aa),
+                  objects, lights, resolution, aa};
+    scene_gen_params params;
+    params.spheres = objects;
+    params.directional_lights = lights;
+    params.aa_samples = aa;
+    std::ofstream out(workdir / (c.scene + ".txt"));
+    scene_generator(params).write(out);
+    return c;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<hw2_config> configs;
+    fs::path scenes = HW2_SOURCE_DIR;
+    std::string out_path = "render_bench.csv";
+    int repeats = 3;
+    bool quick = false;
+    std::vector<std::string> extra_args;
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--hw2" && a + 1 < argc) configs.push_back({"hw2", fs::absolute(argv[++a]).string()});
+        else if (arg == "--config" && a + 1 < argc) {
+            std::string spec = argv[++a];
+            size_t eq = spec.find('=');
+            if (eq == std::string::npos) throw std::runtime_error("--config expects label=path, got " + spec);
+            configs.push_back({spec.substr(0, eq), fs::absolute(spec.substr(eq + 1)).string()});
+        }
+        else if (arg == "--scenes" && a + 1 < argc) scenes = argv[++a];
+        else if (arg == "--out" && a + 1 < argc) out_path = argv[++a];
+        else if (arg == "--repeats" && a + 1 < argc) repeats = std::max(1, std::atoi(argv[++a]));
+        else if (arg == "--quick") quick = true;
+        else if (arg == "--") {
+            extra_args.assign(argv + a + 1, argv + argc);
+            break;
+        }
+    }
+
+    if (configs.empty()) configs.push_back({"hw2", (fs::absolute(fs::path(argv[0])).parent_path() / "hw2").string()});
+
+    fs::path workdir = fs::temp_directory_path() / ("hw2_render_bench_" + std::to_string(getpid()));
+    fs::create_directories(workdir);
+
+    std::vector<render_case> cases;
+    for (const char* name : {"scene1", "scene2", "scene3", "scene4", "scene5",
+                             "our_scene1", "our_scene2", "our_scene2aa", "our_scene3"}) {
+        fs::path src = scenes / (std::string(name) + ".txt");
+        if (!fs::exists(src)) continue;
+        fs::copy_file(src, workdir / src.filename(), fs::copy_options::overwrite_existing);
+        render_case c{"bundled", name, 0, 0, RENDER_BENCH_RESOLUTION, 1};
+        describe_scene(src, c);
+        cases.push_back(c);
+    }
+
+    std::vector<size_t> objects = {100, 1000, 10000, 100000, 1000000};
+    std::vector<size_t> lights = {1, 4, 16, 64};
+    std::vector<int> resolutions = {128, 256, 512, 1024};
+    std::vector<int> aa = {1, 2, 3, 4};
+    if (quick) {
+        objects.pop_back();
+        lights.pop_back();
+        resolutions.pop_back();
+        aa.pop_back();
+    }
+    for (size_t n : objects) cases.push_back(generated_case(workdir, "objects", n, SWEEP_LIGHTS, SWEEP_RESOLUTION, SWEEP_AA));
+    for (size_t n : lights) cases.push_back(generated_case(workdir, "lights", SWEEP_OBJECTS, n, SWEEP_RESOLUTION, SWEEP_AA));
+    for (int r : resolutions) cases.push_back(generated_case(workdir, "resolution", SWEEP_OBJECTS, SWEEP_LIGHTS, r, SWEEP_AA));
+    for (int s : aa) cases.push_back(generated_case(workdir, "aa", SWEEP_OBJECTS, SWEEP_LIGHTS, SWEEP_RESOLUTION, s));
+
+    std::ofstream csv(out_path);
+    if (!csv) throw std::runtime_error("Failed to open " + out_path);
+    csv << "config,group,scene,objects,lights,resolution,aa,wall_s,render_s,primary_rays,shadow_rays,rays_per_s,"
+           "peak_rss_mb,speedup\n";
+
+    std::vector<double> total_wall(configs.size(), 0.0);
+    for (const render_case& c : cases) {
+        double baseline_wall = 0;
+        for (size_t k = 0; k < configs.size(); k++) {
+            const hw2_config& config = configs[k];
+            // median run by wall time, the largest resident size of any run
+            std::vector<run_result> runs;
+            for (int n = 0; n < repeats; n++) runs.push_back(run_hw2(config.path, workdir, c, extra_args));
+            std::sort(runs.begin(), runs.end(), [](const run_result& a, const run_result& b) { return a.wall_s < b.wall_s; });
+            run_result r = runs[runs.size() / 2];
+            for (const auto& run : runs) r.peak_rss_mb = std::max(r.peak_rss_mb, run.peak_rss_mb);
+            if (k == 0) baseline_wall = r.wall_s;
+            double speedup = r.wall_s > 0 ? baseline_wall / r.wall_s : 0.0;
+            total_wall[k] += r.wall_s;
+
+            long long primary = (long long)c.resolution * c.resolution * c.aa * c.aa;
+            long long rays = primary + std::max(0LL, r.shadow_rays);
+            double rays_per_s = r.render_s > 0 ? double(rays) / r.render_s : 0.0;
+            csv << config.label << "," << c.group << "," << c.scene << "," << c.objects << "," << c.lights << ","
+                << c.resolution << "," << c.aa << "," << r.wall_s << "," << r.render_s << "," << primary << ","
+                << (r.shadow_rays >= 0 ? std::to_string(r.shadow_rays) : "") << "," << rays_per_s << ","
+                << r.peak_rss_mb << "," << speedup << "\n";
+            std::printf("%-10s %-12s %-34s %8.3f s  %12.0f rays/s  %8.1f MB  %5.2fx\n", config.label.c_str(),
+                        c.group.c_str(), c.scene.c_str(), r.wall_s, rays_per_s, r.peak_rss_mb, speedup);
+        }
+    }
+
+    // speedup over the whole run, every case weighted by its time on the first build
+    if (configs.size() > 1) {
+        for (size_t k = 0; k < configs.size(); k++)
+            std::printf("%-10s total %8.3f s  %5.2fx\n", configs[k].label.c_str(), total_wall[k],
+                        total_wall[k] > 0 ? total_wall[0] / total_wall[k] : 0.0);
+    }
+
+    fs::remove_all(workdir);
+    return 0;
+}
@@ -0,0 +1,168 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "trace.h"
+
+// what the renderer counts when built with HW2_RENDER_STATS
+enum stat_counter {
+    STAT_PRIMARY_RAYS,
+    STAT_SHADOW_RAYS,
+    STAT_OCCLUSION_EARLY_OUTS, // shadow rays stopped at the first blocker found
+    STAT_SPHERE_TESTS,
+    STAT_PLANE_TESTS,
+    STAT_INSTANCE_TESTS,
+    STAT_SHADING_EVALS,        // surfaces shaded, one per primary ray that hit
+    STAT_COUNT
+};
+
+inline const char* stat_name(int c) {
+    static const char* names[STAT_COUNT] = {
+        "primary_rays", "shadow_rays", "occlusion_early_outs",
+        "sphere_tests", "plane_tests", "instance_tests", "shading_evals"
+    };
+    return names[c];
+}
+
+struct stat_block {
+    uint64_t count[STAT_COUNT] = {};
+
+    void add(const stat_block& other) {
+        for (int c = 0; c < STAT_COUNT; c++) count[c] += other.count[c];
+    }
+};
+
+// Process-wide statistics: counter totals merged from every thread, and the
+// wall time of each phase in the order the phases first ran.
+class render_stats {
+public:
+    static render_stats& get() {
+        static render_stats stats;
+        return stats;
+    }
+
+    void merge(const stat_block& block) {
+        std::lock_guard<std::mutex> lock(mutex);
+        merged.add(block);
+    }
+
+    void add_phase(const std::string& name, double seconds) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& p : phases) {
+            if (p.first == name) {
+                p.second += seconds;
+                return;
+            }
+        }
+        phases.emplace_back(name, seconds);
+    }
+
+    /// counters of finished threads plus the calling thread's
+    stat_block totals() const;
+
+    static bool counters_enabled() {
+#ifdef HW2_RENDER_STATS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void print(std::ostream& out) const {
+        out << "Phases:\n";
+        for (const auto& p : phase_list()) out << "  " << p.first << ": " << p.second * 1000.0 << " ms\n";
+        if (!counters_enabled()) {
+            out << "Counters: not built in, configure with -DHW2_RENDER_STATS=ON\n";
+            return;
+        }
+        stat_block t = totals();
+        out << "Counters:\n";
+        for (int c = 0; c < STAT_COUNT; c++) out << "  " << stat_name(c) << ": " << t.count[c] << "\n";
+    }
+
+    void write_json(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) throw std::runtime_error("Failed to open stats file: " + path);
+        out << "{\n  \"phases_ms\": {";
+        auto list = phase_list();
+        for (size_t k = 0; k < list.size(); k++)
+            out << (k ? ", " : "") << "\"" << list[k].first << "\": " << list[k].second * 1000.0;
+        out << "},\n  \"counters\": {";
+        if (counters_enabled()) {
+            stat_block t = totals();
+            for (int c = 0; c < STAT_COUNT; c++) out << (c ? ", " : "") << "\"" << stat_name(c) << "\": " << t.count[c];
+        }
+        out << "}\n}\n";
+    }
+
+private:
+    mutable std::mutex mutex;
+    stat_block merged;
+    std::vector<std::pair<std::string, double>> phases;
+
+    std::vector<std::pair<std::string, double>> phase_list() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return phases;
+    }
+};
+
+// Counters of one thread, plain increments on the hot path, added to the
+// process totals when the thread exits.
+struct thread_stats {
+    stat_block block;
+    ~thread_stats() { render_stats::get().merge(block); }
+};
+
+inline thread_local thread_stats local_stats;
+
+inline stat_block render_stats::totals() const {
+    stat_block t;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        t = merged;
+    }
+    t.add(local_stats.block);
+    return t;
+}
+
+#ifdef HW2_RENDER_STATS
+#define COUNT_STAT(counter) (local_stats.block.count[counter]++)
+#define COUNT_STAT_N(counter, n) (local_stats.block.count[counter] += (n))
+#else
+#define COUNT_STAT(counter) ((void)0)
+#define COUNT_STAT_N(counter, n) ((void)0)
+#endif
+
+// adds the wall time from construction to stop() or destruction to a phase,
+// and a span of the same name to the trace when tracing
+class scoped_phase {
+public:
+    explicit scoped_phase(const char* name) : name(name), start(tracer::get().now()) {}
+    ~scoped_phase() { stop(); }
+
+    void stop() {
+        if (stopped) return;
+        stopped = true;
+        uint64_t end = tracer::get().now();
+        render_stats::get().add_phase(name, double(end - start) * 1e-9);
+        trace_record(name, start, end);
+    }
+
+    scoped_phase(const scoped_phase&) = delete;
+    scoped_phase& operator=(const scoped_phase&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+    bool stopped = false;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// PCG output permutation, a good 32-bit integer hash that also decorrelates
+// consecutive inputs
+inline uint32_t pcg_hash(uint32_t v) {
+    uint32_t s = v * 747796405u + 2891336453u;
+    uint32_t word = ((s >> ((s >> 28u) + 4u)) ^ s) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Random numbers for one pixel, derived from the render seed and the pixel
+// index alone, so a pixel gets the same samples in whatever order or on
+// whatever thread pixels are rendered.
+class pixel_rng {
+public:
+    pixel_rng(uint32_t seed, uint32_t pixel) : state(pcg_hash(seed ^ pcg_hash(pixel))) {}
+
+    /// @return uniform double in [0, 1)
+    double next() {
+        state += 0x9e3779b9u;
+        return pcg_hash(state) * (1.0 / 4294967296.0);
+    }
+
+private:
+    uint32_t state;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SCENE_DATA_H
+#define SCENE_DATA_H
+
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "light_source.h"
+#include "primitive.h"
+
+// The primitives and lights of a loaded scene. All of them, including the
+// primitives of instanced groups, are allocated from one arena, so they sit
+// next to each other in memory and are released together when the scene
+// goes away, also when loading stops halfway with an exception.
+class scene_data {
+public:
+    scene_data() = default;
+    scene_data(const scene_data&) = delete;
+    scene_data& operator=(const scene_data&) = delete;
+
+    /// allocates an object owned by the scene without adding it to the scene
+    template <typename T, typename... Args>
+    T* create(Args&&... args) { return pool.create<T>(std::forward<Args>(args)...); }
+
+    void add_object(primitive* obj) { objects.push_back(obj); }
+    void add_light(light_source* light) { lights.push_back(light); }
+
+    const std::vector<primitive*>& get_objects() const { return objects; }
+    const std::vector<light_source*>& get_lights() const { return lights; }
+    size_t memory_bytes() const { return pool.bytes_reserved(); }
+
+private:
+    arena pool; // destroyed last, the vectors only point into it
+    std::vector<primitive*> objects;
+    std::vector<light_source*> lights;
+};
+
+#endif
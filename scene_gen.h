@@ -0,0 +1,159 @@
+#ifndef SCENE_GEN_H
+#define SCENE_GEN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// how generated spheres are placed inside the box the camera looks at
+enum class scene_distribution {
+    uniform,   // evenly through the whole box
+    clustered, // normally distributed around a few random centers
+    layered    // in thin horizontal slabs with empty space between them
+};
+
+inline scene_distribution parse_distribution(const std::string& name) {
+    if (name == "uniform") return scene_distribution::uniform;
+    if (name == "clustered") return scene_distribution::clustered;
+    if (name == "layered") return scene_distribution::layered;
+    throw std::runtime_error("Unknown distribution: " + name);
+}
+
+// what a generated scene holds
+struct scene_gen_params {
+    size_t spheres = 1000;
+    size_t planes = 1;             // floor, back wall, side walls, then tilted planes behind the box
+    size_t directional_lights = 2;
+    size_t spotlights = 0;
+    scene_distribution distribution = scene_distribution::uniform;
+    size_t clusters = 0;           // clustered, 0 picks about sqrt(spheres) / 4
+    size_t layers = 6;             // layered
+    int aa_samples = 1;
+    uint32_t seed = 1;
+};
+
+// Writes a scene file in the e/a/o/c/d/p/i format. Spheres fill the box the
+// default camera at z = 4 looks at and are sized so they take about the same
+// share of it whatever their count. The same parameters always give the same file.
+class scene_generator {
+public:
+    explicit scene_generator(const scene_gen_params& params) : params(params), gen(params.seed) {}
+
+    void write(std::ostream& out) {
+        out << "e 0.0 0.0 4.0 " << params.aa_samples << "\n";
+        out << "a 0.1 0.1 0.1 1.0\n";
+
+        // objects, then their materials in the same order
+        for (size_t k = 0; k < params.planes; k++) write_plane(out, k);
+        write_spheres(out);
+        for (size_t k = 0; k < params.planes; k++) out << "c 0.8 0.8 0.8 5.0\n";
+        for (size_t k = 0; k < params.spheres; k++)
+            out << "c " << uniform(0.1, 1.0) << " " << uniform(0.1, 1.0) << " " << uniform(0.1, 1.0) << " "
+                << uniform(5.0, 100.0) << "\n";
+
+        // directional lights from above, then spotlights above the box aimed into it;
+        // the i lines follow the d lines, the p lines the spotlights among them
+        size_t lights = params.directional_lights + params.spotlights;
+        for (size_t k = 0; k < params.directional_lights; k++)
+            out << "d " << uniform(-1.0, 1.0) << " -1.0 " << uniform(-1.0, 1.0) << " 0.0\n";
+        std::vector<point> spot_positions;
+        for (size_t k = 0; k < params.spotlights; k++) {
+            point from{uniform(BOX_LO[0], BOX_HI[0]), BOX_HI[1] + 1.0, uniform(BOX_LO[2], BOX_HI[2])};
+            point to{uniform(BOX_LO[0], BOX_HI[0]), BOX_LO[1], uniform(BOX_LO[2], BOX_HI[2])};
+            out << "d " << to.x - from.x << " " << to.y - from.y << " " << to.z - from.z << " 1.0\n";
+            spot_positions.push_back(from);
+        }
+        for (const point& p : spot_positions)
+            out << "p " << p.x << " " << p.y << " " << p.z << " " << uniform(0.8, 0.95) << "\n";
+        // split the light so images keep about the same brightness
+        double share = 1.0 / double(lights ? lights : 1);
+        for (size_t k = 0; k < lights; k++)
+            out << "i " << share << " " << share << " " << share << " 1.0\n";
+    }
+
+private:
+    struct point { double x, y, z; };
+
+    static constexpr double BOX_LO[3] = {-2.0, -2.0, -6.0};
+    static constexpr double BOX_HI[3] = {2.0, 2.0, -1.0};
+
+    scene_gen_params params;
+    std::mt19937 gen; // fixed algorithm, unlike the std distributions
+
+    double uniform(double lo, double hi) { return lo + (hi - lo) * (double(gen()) * (1.0 / 4294967296.0)); }
+
+    // standard normal by Box-Muller, from uniform so the sequence is the same everywhere
+    double normal() {
+        double u = uniform(1e-12, 1.0), v = uniform(0.0, 1.0);
+        return std::sqrt(-2.0 * std::log(u)) * std::cos(6.283185307179586 * v);
+    }
+
+    // a plane through point p with normal n, written as n.x + d = 0 with d <= 0
+    // since the parser reads w > 0 as a sphere
+    static void plane_line(std::ostream& out, point n, point p) {
+        double d = -(n.x * p.x + n.y * p.y + n.z * p.z);
+        if (d > 0) {
+            n = {0.0 - n.x, 0.0 - n.y, 0.0 - n.z}; // 0.0 - 0.0 is 0, -0.0 would print as -0
+            d = -d;
+        }
+        out << "o " << n.x << " " << n.y << " " << n.z << " " << d << "\n";
+    }
+
+    void write_plane(std::ostream& out, size_t k) {
+        if (k == 0) return plane_line(out, {0, 1, 0}, {0, BOX_LO[1], 0});                // floor
+        if (k == 1) return plane_line(out, {0, 0, 1}, {0, 0, BOX_LO[2] - 1.0});          // back wall
+        if (k == 2) return plane_line(out, {1, 0, 0}, {BOX_LO[0] - 1.0, 0, 0});          // left wall
+        if (k == 3) return plane_line(out, {-1, 0, 0}, {BOX_HI[0] + 1.0, 0, 0});         // right wall
+        // facing the camera, tilted a little, further back each time
+        plane_line(out, {uniform(-0.3, 0.3), uniform(-0.3, 0.3), 1.0}, {0, 0, BOX_LO[2] - 1.0 - double(k)});
+    }
+
+    void write_spheres(std::ostream& out) {
+        if (params.spheres == 0) return;
+        double volume = (BOX_HI[0] - BOX_LO[0]) * (BOX_HI[1] - BOX_LO[1]) * (BOX_HI[2] - BOX_LO[2]);
+        double radius = 0.3 * std::cbrt(volume / double(params.spheres));
+
+        size_t clusters = params.clusters ? params.clusters
+                                          : std::max<size_t>(1, size_t(std::sqrt(double(params.spheres)) / 4));
+        std::vector<point> centers;
+        if (params.distribution == scene_distribution::clustered)
+            for (size_t k = 0; k < clusters; k++)
+                centers.push_back({uniform(BOX_LO[0], BOX_HI[0]), uniform(BOX_LO[1], BOX_HI[1]), uniform(BOX_LO[2], BOX_HI[2])});
+        // a cluster spreads over about its share of the box
+        double sigma = 0.5 * std::cbrt(volume / double(clusters));
+        size_t layers = std::max<size_t>(1, params.layers);
+        double layer_gap = (BOX_HI[1] - BOX_LO[1]) / double(layers);
+
+        for (size_t k = 0; k < params.spheres; k++) {
+            point p{};
+            switch (params.distribution) {
+            case scene_distribution::uniform:
+                p = {uniform(BOX_LO[0], BOX_HI[0]), uniform(BOX_LO[1], BOX_HI[1]), uniform(BOX_LO[2], BOX_HI[2])};
+                break;
+            case scene_distribution::clustered: {
+                const point& c = centers[std::min(size_t(uniform(0.0, double(clusters))), clusters - 1)];
+                p = {c.x + sigma * normal(), c.y + sigma * normal(), c.z + sigma * normal()};
+                p.x = std::min(std::max(p.x, BOX_LO[0]), BOX_HI[0]);
+                p.y = std::min(std::max(p.y, BOX_LO[1]), BOX_HI[1]);
+                p.z = std::min(std::max(p.z, BOX_LO[2]), BOX_HI[2]);
+                break;
+            }
+            case scene_distribution::layered: {
+                // slabs a tenth of the gap thick, centered in their share of the height
+                double layer = double(std::min(size_t(uniform(0.0, double(layers))), layers - 1));
+                double y = BOX_LO[1] + (layer + 0.5) * layer_gap + uniform(-0.05, 0.05) * layer_gap;
+                p = {uniform(BOX_LO[0], BOX_HI[0]), y, uniform(BOX_LO[2], BOX_HI[2])};
+                break;
+            }
+            }
+            out << "o " << p.x << " " << p.y << " " << p.z << " " << radius * uniform(0.5, 1.5) << "\n";
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,54 @@
+// Writes a generated scene file for stress tests and benchmarks.
+//
+// Usage: hw2_scenegen [-o file.txt] [--spheres n] [--planes n] [--directional n]
+//                     [--spots n] [--distribution uniform|clustered|layered]
+//                     [--clusters n] [--layers n] [--aa n] [--seed n]
+// Without -o the scene goes to standard output.
+
+#include "scene_gen.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+int main(int argc, char* argv[]) {
+    scene_gen_params params;
+    std::string out_path;
+    try {
+        for (int a = 1; a < argc; a++) {
+            std::string arg = argv[a];
+            if (a + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+            std::string value = argv[++a];
+            if (arg == "-o") out_path = value;
+            else if (arg == "--spheres") params.spheres = std::stoul(value);
+            else if (arg == "--planes") params.planes = std::stoul(value);
+            else if (arg == "--directional") params.directional_lights = std::stoul(value);
+            else if (arg == "--spots") params.spotlights = std::stoul(value);
+            else if (arg == "--distribution") params.distribution = parse_distribution(value);
+            else if (arg == "--clusters") params.clusters = std::stoul(value);
+            else if (arg == "--layers") params.layers = std::stoul(value);
+            else if (arg == "--aa") params.aa_samples = std::stoi(value);
+            else if (arg == "--seed") params.seed = uint32_t(std::stoul(value));
+            else throw std::runtime_error("Unknown option: " + arg);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n"
+                  << "Usage: " << argv[0] << " [-o file.txt] [--spheres n] [--planes n] [--directional n] [--spots n]"
+                  << " [--distribution uniform|clustered|layered] [--clusters n] [--layers n] [--aa n] [--seed n]\n";
+        return 1;
+    }
+
+    scene_generator generator(params);
+    if (out_path.empty()) {
+        generator.write(std::cout);
+        return 0;
+    }
+    std::ofstream out(out_path);
+    if (!out) {
+        std::cerr << "Failed to open " << out_path << "\n";
+        return 1;
+    }
+    generator.write(out);
+    return 0;
+}
@@ -2,13 +2,15 @@
 #define SPHERE_H
 
 #include "primitive.h"
+#include "render_stats.h"
 #include "vec3.h"
 
 class sphere : public primitive {
     public:
-        sphere(const point3& center, double radius) : center(center), radius(std::fmax(0, radius)) {}
+        sphere(const point3& center, real radius) : center(center), radius(std::fmax(real(0), radius)) {}
 
-        bool hit(const ray& r, double ray_tmin, double ray_tmax, hit_struct& hit_out) const override {
+        bool hit(const ray& r, real ray_tmin, real ray_tmax, hit_struct& hit_out) const override {
+            COUNT_STAT(STAT_SPHERE_TESTS);
             // solving quadratic equation for hitting sphere with b = -2h
             // simplifies to (h+- sqrt(h^2 - ac)) / a
             vec3 oc = center - r.origin();
@@ -28,20 +30,33 @@ class sphere : public primitive {
             }
 
             hit_out.t = root;
-            hit_out.p = r.at(root);
-            hit_out.normal = (hit_out.p - center) / radius;
+            hit_out.prim = this;
+            hit_out.placement = nullptr;
 
             return true;
         }
 
-        color get_color_at(const ray& /*r*/, const hit_struct& hit) const override 
+        hit_surface surface_at(const ray& r, const hit_struct& hit) const override {
+            hit_surface s;
+            s.p = r.at(hit.t);
+            s.normal = (s.p - center) / radius;
+            return s;
+        }
+
+        color get_color_at(const ray& /*r*/, const hit_surface& /*surf*/) const override 
         {
             return material.ambient;
         }
+
+        bool bounding_box(aabb& box_out) const override {
+            vec3 r(radius, radius, radius);
+            box_out = aabb(center - r, center + r);
+            return true;
+        }
         
     private:
         point3 center;
-        double radius;
+        real radius;
 };
 
 #endif
\ No newline at end of file
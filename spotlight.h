@@ -7,7 +7,7 @@
 class spotlight : public light_source {
     point3 position;   
     vec3   dir;        
-    double cutoff;     
+    real   cutoff;     
     color  radiance;   
 public:
     /// @param pos        light position
@@ -16,7 +16,7 @@ public:
     /// @param intensity  RGB radiance at the center
     spotlight(const point3& pos,
               const vec3&   direction,
-              double        cosAngle,
+              real          cosAngle,
               const color&  intensity)
       : position(pos),
         dir(unit_vector(direction)),
@@ -31,14 +31,17 @@ public:
 
     color intensityAt(const point3& p) const override {
         vec3 L = unit_vector(p - position);       // direction to light
-        double spotCos = dot(L, dir);            // alignment with cone axis
+        real spotCos = dot(L, dir);            // alignment with cone axis
         if (spotCos < cutoff) 
             return color(0,0,0);                 // outside cone
 
         return radiance;
     }
 
-    point3 get_position() { return position; }
+    const point3& get_position() const { return position; }
+    const vec3& get_axis() const { return dir; }
+    real get_cutoff() const { return cutoff; }
+    const color& get_radiance() const { return radiance; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,121 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// one finished span, times in nanoseconds since the tracer was created
+struct trace_event {
+    const char* name; // string literal
+    uint64_t start;
+    uint64_t end;
+    uint32_t tid;
+};
+
+// Timeline of spans from every thread, written as Chrome trace_event JSON
+// (chrome://tracing, ui.perfetto.dev). Off until enabled; a span then costs
+// two clock reads and an append to a buffer owned by its thread, handed over
+// under a lock only when the thread exits or the trace is written.
+class tracer {
+public:
+    static tracer& get() {
+        static tracer t;
+        return t;
+    }
+
+    /// thread id 0, named main in the trace, goes to the calling thread
+    void enable();
+    bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    uint64_t now() const {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch).count());
+    }
+
+    uint32_t next_thread_id() { return thread_ids++; }
+
+    void collect(std::vector<trace_event>& events) {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.insert(finished.end(), events.begin(), events.end());
+        events.clear();
+    }
+
+    /// writes the spans of finished threads and of the calling thread
+    void write(const std::string& path);
+
+private:
+    std::atomic<bool> enabled{false};
+    std::atomic<uint32_t> thread_ids{0};
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<trace_event> finished;
+};
+
+// spans of one thread, ids are handed out in order of first use
+struct thread_trace {
+    std::vector<trace_event> events;
+    uint32_t tid = tracer::get().next_thread_id();
+    ~thread_trace() { tracer::get().collect(events); }
+};
+
+inline thread_local thread_trace local_trace;
+
+// adds a span of the calling thread, times from tracer::now()
+inline void trace_record(const char* name, uint64_t start, uint64_t end) {
+    if (tracer::get().is_enabled()) local_trace.events.push_back({name, start, end, local_trace.tid});
+}
+
+inline void tracer::enable() {
+    (void)local_trace.tid;
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+inline void tracer::write(const std::string& path) {
+    collect(local_trace.events);
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("Failed to open trace file: " + path);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    out << std::fixed << std::setprecision(3); // microseconds
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    uint32_t threads = thread_ids.load();
+    for (uint32_t t = 0; t < threads; t++) {
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t
+            << ", \"args\": {\"name\": \"" << (t == 0 ? "main" : "worker " + std::to_string(t)) << "\"}},\n";
+    }
+    for (size_t k = 0; k < finished.size(); k++) {
+        const trace_event& e = finished[k];
+        out << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.tid
+            << ", \"ts\": " << double(e.start) * 1e-3 << ", \"dur\": " << double(e.end - e.start) * 1e-3 << "}"
+            << (k + 1 < finished.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+}
+
+// records a span from construction to destruction on the calling thread
+class trace_span {
+public:
+    explicit trace_span(const char* name) : name(name) {
+        if (tracer::get().is_enabled()) start = tracer::get().now();
+    }
+    ~trace_span() {
+        if (start != NOT_STARTED) trace_record(name, start, tracer::get().now());
+    }
+
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+private:
+    static constexpr uint64_t NOT_STARTED = ~uint64_t(0);
+    const char* name;
+    uint64_t start = NOT_STARTED;
+};
+
+#endif
@@ -0,0 +1,282 @@
+// Unit tests of renderer internals that the golden images cannot reach, such
+// as how a corrupt file on disk is handled. Every test is a function that
+// returns whether it passed; CHECK prints the failing condition.
+//
+// Usage: hw2_unit_test [test names]
+
+#include "accel_cache.h"
+#include "bvh_wide.h"
+#include "camera.h"
+#include "hw2core.h"
+#include "parallel.h"
+#include "scene_data.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            std::printf("    %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            return false;                                                    \
+        }                                                                    \
+    } while (0)
+
+// a row of n unit spheres along x, enough for a bvh8 of several levels
+static void add_sphere_row(scene_data& world, int n) {
+    for (int i = 0; i < n; i++) world.add_object(world.create<sphere>(point3(real(3 * i), 0, 0), real(1)));
+}
+
+// the sphere a ray down the x axis from the left hits first
+static bool hits_first_sphere(const accelerator& accel) {
+    hit_struct hit;
+    ray r(point3(-10, 0, 0), vec3(1, 0, 0));
+    return accel.closest_hit(r, real(0), real(INFINITY), hit) && std::abs(hit.t - real(9)) < real(1e-4);
+}
+
+// overwrites the first inner child reference of the root with ref
+static bool corrupt_root_child(const fs::path& path, uint32_t ref) {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    bvh8::node root;
+    file.seekg(ACCEL_CACHE_HEADER_BYTES);
+    if (!file.read(reinterpret_cast<char*>(&root), sizeof(root))) return false;
+    for (uint32_t c = 0; c < root.count; c++) {
+        if (root.child[c] & bvh8::LEAF_BIT) continue;
+        root.child[c] = ref;
+        file.seekp(ACCEL_CACHE_HEADER_BYTES);
+        file.write(reinterpret_cast<const char*>(&root), sizeof(root));
+        return bool(file);
+    }
+    return false;
+}
+
+// a cache whose root points back at itself is rejected and rebuilt
+static bool accel_cache_rejects_cycles() {
+    scene_data world;
+    add_sphere_row(world, 200);
+    const auto& scene = world.get_objects();
+    fs::path path = fs::temp_directory_path() / "hw2_unit_test.bvh8.cache";
+    fs::remove(path);
+
+    cached_accelerator<bvh8>(path.string(), scene);
+    uint64_t hash = scene_hash(scene);
+    CHECK(load_accel_cache<bvh8>(path.string(), scene, hash) != nullptr);
+
+    for (uint32_t ref : {0u, 1u << 30}) { // itself, then a node past the end
+        CHECK(corrupt_root_child(path, ref));
+        CHECK(load_accel_cache<bvh8>(path.string(), scene, hash) == nullptr);
+        auto rebuilt = cached_accelerator<bvh8>(path.string(), scene);
+        CHECK(hits_first_sphere(*rebuilt));
+        // the rebuild replaced the corrupt file
+        auto reloaded = load_accel_cache<bvh8>(path.string(), scene, hash);
+        CHECK(reloaded != nullptr);
+        CHECK(hits_first_sphere(*reloaded));
+    }
+    fs::remove(path);
+    return true;
+}
+
+// a cache listing one object twice, and so another not at all, is rebuilt
+static bool accel_cache_rejects_repeated_ids() {
+    scene_data world;
+    add_sphere_row(world, 200);
+    const auto& scene = world.get_objects();
+    fs::path path = fs::temp_directory_path() / "hw2_unit_test_ids.bvh8.cache";
+    fs::remove(path);
+    cached_accelerator<bvh8>(path.string(), scene);
+    uint64_t hash = scene_hash(scene);
+
+    accel_cache_header header;
+    uint32_t ids[2];
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        CHECK(file.read(reinterpret_cast<char*>(&header), sizeof(header)));
+        std::streamoff first_id = std::streamoff(ACCEL_CACHE_HEADER_BYTES + header.node_count * sizeof(bvh8::node));
+        file.seekg(first_id);
+        CHECK(file.read(reinterpret_cast<char*>(ids), sizeof(ids)));
+        CHECK(ids[0] != ids[1]);
+        file.seekp(first_id + std::streamoff(sizeof(uint32_t)));
+        file.write(reinterpret_cast<const char*>(&ids[0]), sizeof(uint32_t));
+        CHECK(bool(file));
+    }
+    CHECK(load_accel_cache<bvh8>(path.string(), scene, hash) == nullptr);
+    auto rebuilt = cached_accelerator<bvh8>(path.string(), scene);
+    CHECK(hits_first_sphere(*rebuilt));
+    CHECK(load_accel_cache<bvh8>(path.string(), scene, hash) != nullptr);
+    fs::remove(path);
+    return true;
+}
+
+// w turns NaN when a vector is divided by zero, dot and length must not see it
+static bool vec3_dot_ignores_w() {
+    vec3 v = vec3(1, 2, 3) / real(0); // inf lanes, NaN w
+    vec3 u(1, 2, 3);
+    u.e[3] = real(NAN);
+    CHECK(std::isnan(v.e[3]));
+    CHECK(dot(u, vec3(1, 1, 1)) == real(6));
+    CHECK(u.length_squared() == real(14));
+    CHECK(std::isinf(dot(v, v)));
+    CHECK(cross(u, vec3(0, 0, 1)).x() == real(2));
+    return true;
+}
+
+// negation flips the sign of zero too, slab setups rely on 1 / -0 being -inf
+static bool vec3_negate_keeps_signed_zero() {
+    vec3 n = -vec3(0, 1, real(-0.0));
+    CHECK(std::signbit(n.x()) && n.y() == real(-1) && !std::signbit(n.z()));
+    CHECK(real(1) / n.x() == -real(INFINITY));
+    return true;
+}
+
+// rays that differ only in the sign of x must form two runs, not interleave
+static bool ray_order_separates_x_octants() {
+    struct entry { point3 origin; vec3 dir; };
+    std::vector<entry> batch;
+    for (int i = 0; i < 256; i++) {
+        point3 origin(real(i % 16), real(i / 16), real((i * 7) % 5));
+        batch.push_back({origin, vec3(1, 1, 1)});
+        batch.push_back({origin, vec3(-1, 1, 1)});
+    }
+    std::vector<uint64_t> order;
+    order_ray_batch(batch, order);
+    CHECK(order.size() == batch.size());
+
+    int runs = 1;
+    std::vector<bool> seen(batch.size(), false);
+    for (size_t k = 0; k < order.size(); k++) {
+        size_t index = ray_order_index(order[k]);
+        CHECK(index < batch.size() && !seen[index]);
+        seen[index] = true;
+        if (k > 0 && (batch[index].dir.x() < 0) != (batch[ray_order_index(order[k - 1])].dir.x() < 0)) runs++;
+    }
+    CHECK(runs == 2);
+    return true;
+}
+
+// whether f throws std::logic_error
+template <typename F>
+static bool throws_logic_error(F f) {
+    try {
+        f();
+    } catch (const std::logic_error&) {
+        return true;
+    }
+    return false;
+}
+
+// a red sphere lit from the front, 40x40 so some tiles are cut off at the edge
+static renderer small_scene(render_options& options) {
+    renderer r;
+    r.set_camera({0, 0, 4});
+    r.add_sphere({0, 0, 0}, 0.5, {{0.1, 0.1, 0.1}, {1, 0, 0}, 10});
+    r.add_directional_light({0, 0, -1}, {1, 1, 1});
+    options.width = options.height = 40;
+    options.seed = 1;
+    return r;
+}
+
+// a handle moved from, or whose image was taken, throws rather than reading
+// freed state, and the snapshot of a finished job is the whole image
+static bool render_job_empty_handles() {
+    render_options options;
+    renderer r = small_scene(options);
+    render_job job = r.render_async(options);
+    job.wait();
+    framebuffer snap = job.snapshot();
+    render_job moved = std::move(job);
+
+    job.cancel();
+    job.wait();
+    CHECK(job.is_done() && !job.was_cancelled());
+    CHECK(job.tiles_done() == 0 && job.tiles_total() == 0);
+    CHECK(throws_logic_error([&] { job.get(); }));
+
+    CHECK(moved.tiles_done() == moved.tiles_total() && moved.tiles_total() == 4);
+    framebuffer image = moved.get();
+    CHECK(std::equal(snap.data(), snap.data() + size_t(40) * 40 * 3, image.data()));
+    CHECK(image.pixel(20, 20)[0] > 0.5f); // red in the middle
+
+    // the image is taken once
+    CHECK(throws_logic_error([&] { moved.get(); }));
+    CHECK(throws_logic_error([&] { moved.snapshot(); }));
+    return true;
+}
+
+// what a worker throws reaches the caller after every worker is joined
+static bool parallel_chunks_rethrows() {
+    std::atomic<int> finished{0};
+    bool caught = false;
+    try {
+        parallel_chunks(100, 4, [&](unsigned chunk, size_t, size_t) {
+            if (chunk == 1) throw std::runtime_error("chunk 1");
+            finished++;
+        });
+    } catch (const std::runtime_error& e) {
+        caught = std::string(e.what()) == "chunk 1";
+    }
+    CHECK(caught && finished == 3);
+    return true;
+}
+
+// a progress callback that throws ends the render, and get rethrows it
+static bool render_job_rethrows_progress_error() {
+    render_options options;
+    renderer r = small_scene(options);
+    render_job job = r.render_async(options, [](size_t done, size_t) {
+        if (done == 2) throw std::runtime_error("progress");
+    });
+    bool caught = false;
+    try {
+        job.get();
+    } catch (const std::runtime_error& e) {
+        caught = std::string(e.what()) == "progress";
+    }
+    CHECK(caught && job.tiles_done() >= 2); // tiles already started on other threads still finish
+    return true;
+}
+
+struct unit_test {
+    const char* name;
+    bool (*run)();
+};
+
+static const unit_test tests[] = {
+    {"accel_cache_rejects_cycles", accel_cache_rejects_cycles},
+    {"accel_cache_rejects_repeated_ids", accel_cache_rejects_repeated_ids},
+    {"vec3_dot_ignores_w", vec3_dot_ignores_w},
+    {"vec3_negate_keeps_signed_zero", vec3_negate_keeps_signed_zero},
+    {"ray_order_separates_x_octants", ray_order_separates_x_octants},
+    {"parallel_chunks_rethrows", parallel_chunks_rethrows},
+    {"render_job_empty_handles", render_job_empty_handles},
+    {"render_job_rethrows_progress_error", render_job_rethrows_progress_error},
+};
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> names(argv + 1, argv + argc);
+    int failures = 0, run = 0;
+    for (const unit_test& test : tests) {
+        bool selected = names.empty();
+        for (const std::string& name : names) selected = selected || name == test.name;
+        if (!selected) continue;
+        bool ok = test.run();
+        std::printf("%-34s %s\n", test.name, ok ? "ok" : "FAIL");
+        failures += ok ? 0 : 1;
+        run++;
+    }
+    if (run == 0) {
+        std::printf("no test matches\n");
+        return 1;
+    }
+    if (failures) std::printf("%d of %d tests failed\n", failures, run);
+    return failures ? 1 : 0;
+}
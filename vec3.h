@@ -4,72 +4,225 @@
 #include <cmath>
 #include <iostream>
 
-class vec3 {
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define VEC3_SSE 1
+#endif
+
+// scalar type of the whole geometry pipeline, float when built with HW2_SINGLE_PRECISION
+#ifdef HW2_SINGLE_PRECISION
+using real = float;
+#else
+using real = double;
+#endif
+
+// Lane arithmetic on the four stored components of a vec3_t. The generic
+// version is scalar, float and double map to SSE (and AVX for double when enabled).
+// The w lane starts at zero but is not kept there: scaling by an infinite
+// factor (a division by zero) makes it 0 * inf = NaN. No operation moves w into
+// x, y or z, and dot leaves it out of the sum, so a NaN there stays harmless.
+template <typename T>
+struct vec3_lanes {
+    static void add(T* out, const T* a, const T* b) { for (int i = 0; i < 4; i++) out[i] = a[i] + b[i]; }
+    static void sub(T* out, const T* a, const T* b) { for (int i = 0; i < 4; i++) out[i] = a[i] - b[i]; }
+    static void mul(T* out, const T* a, const T* b) { for (int i = 0; i < 4; i++) out[i] = a[i] * b[i]; }
+    static void scale(T* out, const T* a, T s) { for (int i = 0; i < 4; i++) out[i] = a[i] * s; }
+    static void neg(T* out, const T* a) { for (int i = 0; i < 4; i++) out[i] = -a[i]; }
+    static T dot(const T* a, const T* b) { return a[0]*b[0] + a[1]*b[1] + a[2]*b[2]; }
+    static void cross(T* out, const T* a, const T* b) {
+        T x = a[1] * b[2] - a[2] * b[1];
+        T y = a[2] * b[0] - a[0] * b[2];
+        T z = a[0] * b[1] - a[1] * b[0];
+        out[0] = x; out[1] = y; out[2] = z; out[3] = 0;
+    }
+};
+
+#if defined(VEC3_SSE)
+template <>
+struct vec3_lanes<float> {
+    static void add(float* out, const float* a, const float* b) { _mm_store_ps(out, _mm_add_ps(_mm_load_ps(a), _mm_load_ps(b))); }
+    static void sub(float* out, const float* a, const float* b) { _mm_store_ps(out, _mm_sub_ps(_mm_load_ps(a), _mm_load_ps(b))); }
+    static void mul(float* out, const float* a, const float* b) { _mm_store_ps(out, _mm_mul_ps(_mm_load_ps(a), _mm_load_ps(b))); }
+    static void scale(float* out, const float* a, float s) { _mm_store_ps(out, _mm_mul_ps(_mm_load_ps(a), _mm_set1_ps(s))); }
+    // flips the sign bits, unlike 0 - a this keeps -0 and +0 apart
+    static void neg(float* out, const float* a) { _mm_store_ps(out, _mm_xor_ps(_mm_load_ps(a), _mm_set1_ps(-0.0f))); }
+
+    static float dot(const float* a, const float* b) {
+        const __m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+        __m128 m = _mm_and_ps(_mm_mul_ps(_mm_load_ps(a), _mm_load_ps(b)), xyz);
+        __m128 s = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1))); // x+y, x+y, z, z
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(s, s)));
+    }
+
+    // a * b.yzx - a.yzx * b gives the cross product in zxy order
+    static void cross(float* out, const float* a, const float* b) {
+        __m128 va = _mm_load_ps(a), vb = _mm_load_ps(b);
+        __m128 a_yzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 b_yzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(va, b_yzx), _mm_mul_ps(a_yzx, vb));
+        _mm_store_ps(out, _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+    }
+};
+
+#if defined(__AVX__)
+template <>
+struct vec3_lanes<double> {
+    static void add(double* out, const double* a, const double* b) { _mm256_store_pd(out, _mm256_add_pd(_mm256_load_pd(a), _mm256_load_pd(b))); }
+    static void sub(double* out, const double* a, const double* b) { _mm256_store_pd(out, _mm256_sub_pd(_mm256_load_pd(a), _mm256_load_pd(b))); }
+    static void mul(double* out, const double* a, const double* b) { _mm256_store_pd(out, _mm256_mul_pd(_mm256_load_pd(a), _mm256_load_pd(b))); }
+    static void scale(double* out, const double* a, double s) { _mm256_store_pd(out, _mm256_mul_pd(_mm256_load_pd(a), _mm256_set1_pd(s))); }
+    static void neg(double* out, const double* a) { _mm256_store_pd(out, _mm256_xor_pd(_mm256_load_pd(a), _mm256_set1_pd(-0.0))); }
+
+    static double dot(const double* a, const double* b) {
+        __m256d m = _mm256_blend_pd(_mm256_mul_pd(_mm256_load_pd(a), _mm256_load_pd(b)), _mm256_setzero_pd(), 0x8);
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(m), _mm256_extractf128_pd(m, 1)); // x+z, y
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+#if defined(__AVX2__)
+    static void cross(double* out, const double* a, const double* b) {
+        __m256d va = _mm256_load_pd(a), vb = _mm256_load_pd(b);
+        __m256d a_yzx = _mm256_permute4x64_pd(va, _MM_SHUFFLE(3, 0, 2, 1));
+        __m256d b_yzx = _mm256_permute4x64_pd(vb, _MM_SHUFFLE(3, 0, 2, 1));
+        __m256d c = _mm256_sub_pd(_mm256_mul_pd(va, b_yzx), _mm256_mul_pd(a_yzx, vb));
+        _mm256_store_pd(out, _mm256_permute4x64_pd(c, _MM_SHUFFLE(3, 0, 2, 1)));
+    }
+#else
+    static void cross(double* out, const double* a, const double* b) {
+        __m256d c = _mm256_set_pd(0, a[0] * b[1] - a[1] * b[0], a[2] * b[0] - a[0] * b[2], a[1] * b[2] - a[2] * b[1]);
+        _mm256_store_pd(out, c);
+    }
+#endif
+};
+#else
+// SSE2 holds two doubles per register, so xy and zw are processed as two halves
+template <>
+struct vec3_lanes<double> {
+    static void add(double* out, const double* a, const double* b) {
+        _mm_store_pd(out,     _mm_add_pd(_mm_load_pd(a),     _mm_load_pd(b)));
+        _mm_store_pd(out + 2, _mm_add_pd(_mm_load_pd(a + 2), _mm_load_pd(b + 2)));
+    }
+    static void sub(double* out, const double* a, const double* b) {
+        _mm_store_pd(out,     _mm_sub_pd(_mm_load_pd(a),     _mm_load_pd(b)));
+        _mm_store_pd(out + 2, _mm_sub_pd(_mm_load_pd(a + 2), _mm_load_pd(b + 2)));
+    }
+    static void mul(double* out, const double* a, const double* b) {
+        _mm_store_pd(out,     _mm_mul_pd(_mm_load_pd(a),     _mm_load_pd(b)));
+        _mm_store_pd(out + 2, _mm_mul_pd(_mm_load_pd(a + 2), _mm_load_pd(b + 2)));
+    }
+    static void scale(double* out, const double* a, double s) {
+        __m128d vs = _mm_set1_pd(s);
+        _mm_store_pd(out,     _mm_mul_pd(_mm_load_pd(a),     vs));
+        _mm_store_pd(out + 2, _mm_mul_pd(_mm_load_pd(a + 2), vs));
+    }
+    static void neg(double* out, const double* a) {
+        __m128d sign = _mm_set1_pd(-0.0);
+        _mm_store_pd(out,     _mm_xor_pd(_mm_load_pd(a),     sign));
+        _mm_store_pd(out + 2, _mm_xor_pd(_mm_load_pd(a + 2), sign));
+    }
+
+    static double dot(const double* a, const double* b) {
+        __m128d zz = _mm_mul_pd(_mm_load_pd(a + 2), _mm_load_pd(b + 2));
+        __m128d s = _mm_add_pd(_mm_mul_pd(_mm_load_pd(a), _mm_load_pd(b)),
+                               _mm_move_sd(_mm_setzero_pd(), zz)); // x+z, y
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+    static void cross(double* out, const double* a, const double* b) {
+        __m128d a_xy = _mm_load_pd(a), a_zw = _mm_load_pd(a + 2);
+        __m128d b_xy = _mm_load_pd(b), b_zw = _mm_load_pd(b + 2);
+        __m128d a_yz = _mm_shuffle_pd(a_xy, a_zw, 1), a_zx = _mm_shuffle_pd(a_zw, a_xy, 0);
+        __m128d b_yz = _mm_shuffle_pd(b_xy, b_zw, 1), b_zx = _mm_shuffle_pd(b_zw, b_xy, 0);
+        // x and y from a.yz * b.zx - a.zx * b.yz, z from the low lane of a.xy * b.yy - a.yy * b.xy
+        __m128d c_xy = _mm_sub_pd(_mm_mul_pd(a_yz, b_zx), _mm_mul_pd(a_zx, b_yz));
+        __m128d c_zz = _mm_sub_pd(_mm_mul_pd(a_xy, _mm_unpackhi_pd(b_xy, b_xy)), _mm_mul_pd(_mm_unpackhi_pd(a_xy, a_xy), b_xy));
+        _mm_store_pd(out, c_xy);
+        _mm_store_pd(out + 2, _mm_move_sd(_mm_setzero_pd(), c_zz));
+    }
+};
+#endif
+#endif
+
+// 3-component vector stored in 4 aligned lanes (w is padding, see vec3_lanes) so every
+// operation is one or two SIMD instructions
+template <typename T>
+class alignas(4 * sizeof(T)) vec3_t {
     public:
-        double e[3];
-        
-        vec3() : e{0, 0, 0} {}
-        vec3(double e1, double e2, double e3) : e{e1, e2, e3} {}
-
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
-        
-        vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
-
-        vec3 operator+=(vec3 v) { 
-            e[0] += v[0];
-            e[1] += v[1];
-            e[2] += v[2];
+        using scalar = T;
+
+        T e[4];
+
+        vec3_t() : e{0, 0, 0, 0} {}
+        vec3_t(T e1, T e2, T e3) : e{e1, e2, e3, 0} {}
+
+        T x() const { return e[0]; }
+        T y() const { return e[1]; }
+        T z() const { return e[2]; }
+
+        vec3_t operator-() const { vec3_t r; vec3_lanes<T>::neg(r.e, e); return r; }
+        T operator[](int i) const { return e[i]; }
+        T& operator[](int i) { return e[i]; }
+
+        vec3_t& operator+=(const vec3_t& v) {
+            vec3_lanes<T>::add(e, e, v.e);
             return *this;
         }
 
-        vec3 operator*=(double t){
-            e[0] *= t;
-            e[1] *= t;
-            e[2] *= t;
+        vec3_t& operator*=(T t){
+            vec3_lanes<T>::scale(e, e, t);
             return *this;
         }
 
-        vec3 operator/=(double t){
+        vec3_t& operator/=(T t){
             return *this *= 1/t;
         }
 
-        double length() const {
+        T length() const {
             return std::sqrt(length_squared());
         }
 
-        double length_squared() const {
-            return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
+        T length_squared() const {
+            return vec3_lanes<T>::dot(e, e);
         }
 };
 
+using vec3 = vec3_t<real>;
 using point3 = vec3; //alias for code clarity
 
-inline vec3 operator+(const vec3& u, const vec3& v) { return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]); }
+// scalars are taken as vec3_t<T>::scalar so literals like 2 * v or 0.5 * v
+// convert instead of failing template deduction
+
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T>& u, const vec3_t<T>& v) { vec3_t<T> r; vec3_lanes<T>::add(r.e, u.e, v.e); return r; }
 
-inline vec3 operator-(const vec3& u, const vec3& v) { return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]); }
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T>& u, const vec3_t<T>& v) { vec3_t<T> r; vec3_lanes<T>::sub(r.e, u.e, v.e); return r; }
 
-inline vec3 operator*(const vec3& u, const vec3& v) { return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]); } // this is not dot product
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& u, const vec3_t<T>& v) { vec3_t<T> r; vec3_lanes<T>::mul(r.e, u.e, v.e); return r; } // this is not dot product
 
-inline vec3 operator*(double t, const vec3& v) { return vec3(t*v.e[0], t*v.e[1], t*v.e[2]); }
+template <typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T>& v) { vec3_t<T> r; vec3_lanes<T>::scale(r.e, v.e, t); return r; }
 
-inline vec3 operator*(const vec3& v, double t) { return t * v; }
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& v, typename vec3_t<T>::scalar t) { return t * v; }
 
-inline vec3 operator/(const vec3& v, double t) { return (1/t) * v; }
+template <typename T>
+inline vec3_t<T> operator/(const vec3_t<T>& v, typename vec3_t<T>::scalar t) { return (1/t) * v; }
 
-inline double dot(const vec3& u, const vec3& v) { return u.e[0]*v.e[0] + u.e[1]*v.e[1] + u.e[2]*v.e[2]; }
+template <typename T>
+inline T dot(const vec3_t<T>& u, const vec3_t<T>& v) { return vec3_lanes<T>::dot(u.e, v.e); }
 
-inline vec3 cross(const vec3& u, const vec3& v){ 
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T>& u, const vec3_t<T>& v){
+    vec3_t<T> r;
+    vec3_lanes<T>::cross(r.e, u.e, v.e);
+    return r;
 }
 
-inline vec3 unit_vector(const vec3& v){
+template <typename T>
+inline vec3_t<T> unit_vector(const vec3_t<T>& v){
     return v / v.length();
 }
 
-#endif
\ No newline at end of file
+#endif